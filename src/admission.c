@@ -0,0 +1,353 @@
+/**
+ * admission.c -- admission control and rate limiting of mounts
+ *
+ * This software is distributed under the terms and conditions of the
+ * GNU General Public License. See file GPL for the full text of the license.
+ */
+
+#define _GNU_SOURCE
+#include "config.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libintl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "admission.h"
+#include "configuration.h"
+#include "utils.h"
+
+#define ADMISSION_DIR LOCKDIR "/.admission"
+#define BY_ID_DIR "/dev/disk/by-id"
+
+/* how often busy slots are tried again */
+#define ADMISSION_POLL_NS 50000000L
+
+#define NS_PER_SEC 1000000000LL
+
+/** State of the token bucket of a device, as stored in its file */
+struct admission_bucket {
+    double tokens;
+    int64_t last_ns; /* CLOCK_REALTIME, which survives reboots */
+};
+
+static int
+admission_now(clockid_t clock, int64_t *ns)
+{
+    struct timespec ts;
+
+    if(clock_gettime(clock, &ts))
+        return -1;
+    *ns = (int64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+    return 0;
+}
+
+static void
+admission_sleep(int64_t ns)
+{
+    struct timespec ts = { .tv_sec = ns / NS_PER_SEC,
+                           .tv_nsec = ns % NS_PER_SEC };
+
+    while(nanosleep(&ts, &ts) && errno == EINTR)
+        ;
+}
+
+/**
+   Opens (and creates if needed) the admission state directory, as
+   root.
+
+   @return its descriptor, or -1 if it is not usable
+ */
+static int
+admission_open_dir(void)
+{
+    int fd, rc = 0;
+
+    get_root();
+    get_groot();
+    if(mkdir(LOCKDIR, 0755) && errno != EEXIST)
+        rc = -1;
+    else if(mkdir(ADMISSION_DIR, 0700) && errno != EEXIST)
+        rc = -1;
+    drop_groot();
+    drop_root();
+    if(rc) {
+        debug("admission: could not create %s: %s\n", ADMISSION_DIR,
+              strerror(errno));
+        return -1;
+    }
+    get_root();
+    fd = open(ADMISSION_DIR, O_DIRECTORY | O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    drop_root();
+    if(fd < 0)
+        debug("admission: could not open %s: %s\n", ADMISSION_DIR,
+              strerror(errno));
+    return fd;
+}
+
+/**
+   Opens the state file name of the admission directory, as root.
+ */
+static int
+admission_open_file(int dirfd, const char *name)
+{
+    int fd;
+
+    get_root();
+    fd = openat(dirfd, name, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+    drop_root();
+    if(fd < 0)
+        debug("admission: could not open %s/%s: %s\n", ADMISSION_DIR, name,
+              strerror(errno));
+    return fd;
+}
+
+/**
+   Tries to take one of the slots prefix-0 ... prefix-(count - 1). A
+   slot is held as long as its (close-on-exec) descriptor is open, so
+   the descriptor of a taken slot is deliberately never closed.
+
+   @return 1 if a slot was taken, 0 if all of them are busy, -1 on
+   error
+ */
+static int
+admission_try_slot(int dirfd, const char *prefix, unsigned int count)
+{
+    char name[64];
+    int fd, err;
+
+    for(unsigned int i = 0; i < count; i++) {
+        snprintf(name, sizeof(name), "%s-%u", prefix, i);
+        fd = admission_open_file(dirfd, name);
+        if(fd < 0)
+            return -1;
+        if(!flock(fd, LOCK_EX | LOCK_NB)) {
+            debug("admission: took slot %s\n", name);
+            return 1;
+        }
+        err = errno;
+        close(fd);
+        if(err != EWOULDBLOCK) {
+            debug("admission: flock(%s): %s\n", name, strerror(err));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+   Waits for one of count slots named after prefix until deadline (on
+   CLOCK_MONOTONIC).
+
+   @return 1 if a slot was taken, 0 if none got free in time, -1 on
+   error
+ */
+static int
+admission_wait_slot(int dirfd, const char *prefix, unsigned int count,
+                    int64_t deadline)
+{
+    int64_t now;
+    int rc;
+
+    while(!(rc = admission_try_slot(dirfd, prefix, count))) {
+        if(admission_now(CLOCK_MONOTONIC, &now) ||
+           now + ADMISSION_POLL_NS > deadline)
+            break;
+        admission_sleep(ADMISSION_POLL_NS);
+    }
+    return rc;
+}
+
+/**
+   Returns the name that identifies the device across replugging and
+   renaming by the kernel: the first of its /dev/disk/by-id links in
+   alphabetical order, or its lock name if it has none.
+ */
+static char *
+admission_device_name(const char *device)
+{
+    char *real, *link, *target, *best = NULL;
+    struct dirent *ent;
+    DIR *dir;
+
+    real = realpath(device, NULL);
+    dir = real ? opendir(BY_ID_DIR) : NULL;
+    while(dir && (ent = readdir(dir))) {
+        if(ent->d_name[0] == '.' ||
+           (best && strcmp(ent->d_name, best) >= 0))
+            continue;
+        if(asprintf(&link, BY_ID_DIR "/%s", ent->d_name) == -1)
+            break;
+        target = realpath(link, NULL);
+        free(link);
+        if(target && !strcmp(target, real)) {
+            free(best);
+            best = strdup(ent->d_name);
+        }
+        free(target);
+    }
+    if(dir)
+        closedir(dir);
+    free(real);
+
+    if(best)
+        debug("admission: %s is known as %s\n", device, best);
+    return best ? best : make_lock_name(device);
+}
+
+/**
+   Takes a token from the bucket stored in fd, refilled at rate tokens
+   per minute up to burst.
+
+   @return 0 if a token was taken, or else the number of nanoseconds
+   until one is available; -1 on error
+ */
+static int64_t
+admission_take_token(int fd, unsigned int rate, unsigned int burst)
+{
+    struct admission_bucket bucket;
+    int64_t now, wait = 0;
+
+    if(admission_now(CLOCK_REALTIME, &now) || flock(fd, LOCK_EX))
+        return -1;
+
+    /* a missing, short or future state is a full bucket */
+    if(pread(fd, &bucket, sizeof(bucket), 0) != sizeof(bucket) ||
+       bucket.last_ns > now || !(bucket.tokens >= 0)) {
+        bucket.tokens = burst;
+        bucket.last_ns = now;
+    }
+    bucket.tokens += (double)(now - bucket.last_ns) * rate / (60 * NS_PER_SEC);
+    if(bucket.tokens > burst)
+        bucket.tokens = burst;
+    bucket.last_ns = now;
+
+    if(bucket.tokens >= 1)
+        bucket.tokens -= 1;
+    else
+        wait = (int64_t)((1 - bucket.tokens) * 60 * NS_PER_SEC / rate) + 1;
+    debug("admission: %.2f tokens left\n", bucket.tokens);
+
+    if(pwrite(fd, &bucket, sizeof(bucket), 0) != sizeof(bucket))
+        debug("admission: could not save the token bucket\n");
+    flock(fd, LOCK_UN);
+    return wait;
+}
+
+/**
+   Waits for a token of the bucket of device until deadline (on
+   CLOCK_MONOTONIC).
+
+   @return 1 if a token was taken, 0 if none comes in time (and
+   *wait is the time until the next one), -1 on error
+ */
+static int
+admission_wait_token(int dirfd, const char *device, int64_t deadline,
+                     int64_t *wait)
+{
+    unsigned int burst = conffile_device_burst();
+    char *name, *file;
+    int64_t now;
+    int fd, rc;
+
+    name = admission_device_name(device);
+    if(asprintf(&file, "bucket-%s", name) == -1) {
+        free(name);
+        return -1;
+    }
+    free(name);
+    fd = admission_open_file(dirfd, file);
+    free(file);
+    if(fd < 0)
+        return -1;
+
+    for(;;) {
+        *wait = admission_take_token(fd, conffile_device_rate(),
+                                     burst ? burst : 1);
+        if(*wait <= 0) {
+            rc = *wait ? -1 : 1;
+            break;
+        }
+        if(admission_now(CLOCK_MONOTONIC, &now) || now + *wait > deadline) {
+            rc = 0;
+            break;
+        }
+        debug("admission: waiting %lld ms for a token\n",
+              (long long)(*wait / 1000000));
+        admission_sleep(*wait);
+    }
+    close(fd);
+    return rc;
+}
+
+int
+admission_enter(const char *device)
+{
+    unsigned int max_mounts = conffile_max_mounts();
+    unsigned int max_user = conffile_max_mounts_per_user();
+    int64_t deadline, wait;
+    char prefix[32];
+    int dirfd, rc = 1;
+
+    if(!max_mounts && !max_user && !conffile_device_rate())
+        return 0;
+
+    if(admission_now(CLOCK_MONOTONIC, &deadline))
+        return 0;
+    deadline += (int64_t)conffile_admission_wait() * NS_PER_SEC;
+
+    dirfd = admission_open_dir();
+    if(dirfd < 0) {
+        fprintf(stderr, _("Warning: admission control is not available, "
+                          "mounting without limits\n"));
+        return 0;
+    }
+
+    if(conffile_device_rate()) {
+        rc = admission_wait_token(dirfd, device, deadline, &wait);
+        if(!rc) {
+            fprintf(stderr,
+                    _("Error: %s was mounted too often, try again in %lld "
+                      "seconds\n"),
+                    device, (long long)((wait + NS_PER_SEC - 1) / NS_PER_SEC));
+            close(dirfd);
+            return -1;
+        }
+    }
+
+    /* the user's own slots first, so that a user over the limit does
+       not hold one of the shared ones */
+    if(rc > 0 && max_user) {
+        snprintf(prefix, sizeof(prefix), "user-%u", (unsigned int)getuid());
+        rc = admission_wait_slot(dirfd, prefix, max_user, deadline);
+        if(!rc) {
+            fprintf(stderr, _("Error: you have too many mounts in progress, "
+                              "try again later\n"));
+            close(dirfd);
+            return -1;
+        }
+    }
+
+    if(rc > 0 && max_mounts) {
+        rc = admission_wait_slot(dirfd, "slot", max_mounts, deadline);
+        if(!rc) {
+            fprintf(stderr, _("Error: too many mounts in progress, try again "
+                              "later\n"));
+            close(dirfd);
+            return -1;
+        }
+    }
+
+    if(rc < 0)
+        fprintf(stderr, _("Warning: admission control is not available, "
+                          "mounting without limits\n"));
+    close(dirfd);
+    return 0;
+}
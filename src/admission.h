@@ -0,0 +1,32 @@
+/**
+ * @file admission.h - admission control and rate limiting of mounts
+ *
+ * This software is distributed under the terms and conditions of the
+ * GNU General Public License. See file GPL for the full text of the license.
+ */
+
+#ifndef __admission_h
+#define __admission_h
+
+/**
+   Waits for the right to mount device, as limited by the max_mounts,
+   max_mounts_per_user, device_rate and device_burst items of the
+   configuration file.
+
+   A mount holds one of max_mounts system-wide slots and one of the
+   max_mounts_per_user slots of the calling user until pmount exits;
+   the slots are released by the kernel when the process ends, however
+   it ends. Each device (as identified by its /dev/disk/by-id link,
+   which survives replugging) has a token bucket refilled at
+   device_rate tokens per minute, up to device_burst.
+
+   When the limits are reached, the call waits up to admission_wait
+   seconds, then gives up. If the admission state cannot be used,
+   mounting goes on unrestricted.
+
+   @return 0 if the mount may go on, -1 if it is refused (message is
+   printed in this case)
+ */
+int admission_enter(const char *device);
+
+#endif
@@ -10,6 +10,8 @@
 
 #define _POSIX_C_SOURCE 200809L
 #include "config.h"
+#include <errno.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -179,6 +181,7 @@ cf_spec_key_number(const cf_spec *spec)
     case boolean_item:
         return 4;
     case string_list:
+    case uint_item:
         return 1;
     default:
         return 0;
@@ -255,6 +258,7 @@ cf_spec_prepare_keys(cf_spec *spec, cf_key *keys)
         keys->info = CF_KEY_INFO_DENY_USER;
         return;
     case string_list:
+    case uint_item:
         keys->key = strdup(spec->base);
         keys->target = spec;
         keys->info = CF_KEY_INFO_NONE;
@@ -640,6 +644,31 @@ cf_get_gidlist(char *value, gid_list *list)
     return 0;
 }
 
+/**
+   Checks that the given value is an unsigned integer and store it in
+   target.
+ */
+static int
+cf_get_uint(const char *value, ci_uint *target)
+{
+    char buffer[32];
+    unsigned long val;
+    char *end;
+
+    cf_trim_anew(value, buffer, sizeof(buffer));
+    errno = 0;
+    val = strtoul(buffer, &end, 10);
+    if(!*buffer || *end || *buffer == '-' || errno || val > UINT_MAX) {
+        fprintf(stderr,
+                _("Error while reading configuration file: '%s' "
+                  "is not an unsigned integer\n"),
+                value);
+        return -1;
+    }
+    target->value = val;
+    return 0;
+}
+
 /**
    Reads a list of strings into the target
 */
@@ -707,6 +736,8 @@ cf_key_assign_value(cf_key *key, char *value)
     }
     case string_list:
         return cf_read_stringlist(value, key->target->string_list);
+    case uint_item:
+        return cf_get_uint(value, key->target->uint_item);
     default:
         return -1;
     }
@@ -66,6 +66,15 @@ typedef struct {
     char **strings;
 } ci_string_list;
 
+/**
+   An unsigned integer
+*/
+
+typedef struct {
+    /** The value, which is the default until one is read */
+    unsigned int value;
+} ci_uint;
+
 /**
    @todo provide macros for the initialization/declaration of the
    ci_ items?
@@ -76,7 +85,7 @@ typedef struct {
 /**
    The type of configuration items
 */
-typedef enum { boolean_item, string_list } ci_type;
+typedef enum { boolean_item, string_list, uint_item } ci_type;
 
 /**
    Specification of a configuration item.
@@ -100,6 +109,7 @@ typedef struct {
     union {
         ci_bool *boolean_item;
         ci_string_list *string_list;
+        ci_uint *uint_item;
     };
 } cf_spec;
 
@@ -42,6 +42,30 @@ conffile_allow_not_physically_logged(void)
     return ci_bool_allowed(&conf_allow_not_physically_logged);
 }
 
+static ci_bool conf_allow_idmap = { .def = 0 };
+
+int
+conffile_allow_idmap(void)
+{
+    return ci_bool_allowed(&conf_allow_idmap);
+}
+
+static ci_bool conf_allow_drop_cache = { .def = 0 };
+
+int
+conffile_allow_drop_cache(void)
+{
+    return ci_bool_allowed(&conf_allow_drop_cache);
+}
+
+static ci_bool conf_allow_overlay = { .def = 0 };
+
+int
+conffile_allow_overlay(void)
+{
+    return ci_bool_allowed(&conf_allow_overlay);
+}
+
 static ci_bool conf_allow_loop = { .def = 0 };
 
 int
@@ -58,15 +82,145 @@ conffile_loop_devices(void)
     return conf_loop_devices.strings;
 }
 
+static ci_string_list conf_fsck_sched = { .strings = NULL };
+
+char **
+conffile_fsck_sched(void)
+{
+    return conf_fsck_sched.strings;
+}
+
+static ci_string_list conf_cryptsetup_sched = { .strings = NULL };
+
+char **
+conffile_cryptsetup_sched(void)
+{
+    return conf_cryptsetup_sched.strings;
+}
+
+static ci_string_list conf_mount_sched = { .strings = NULL };
+
+char **
+conffile_mount_sched(void)
+{
+    return conf_mount_sched.strings;
+}
+
+static ci_string_list conf_trim_buses = { .strings = NULL };
+
+char **
+conffile_trim_buses(void)
+{
+    return conf_trim_buses.strings;
+}
+
+static ci_uint conf_max_mounts = { .value = 0 };
+
+unsigned int
+conffile_max_mounts(void)
+{
+    return conf_max_mounts.value;
+}
+
+static ci_uint conf_max_mounts_per_user = { .value = 0 };
+
+unsigned int
+conffile_max_mounts_per_user(void)
+{
+    return conf_max_mounts_per_user.value;
+}
+
+static ci_uint conf_device_rate = { .value = 0 };
+
+unsigned int
+conffile_device_rate(void)
+{
+    return conf_device_rate.value;
+}
+
+static ci_uint conf_device_burst = { .value = 3 };
+
+unsigned int
+conffile_device_burst(void)
+{
+    return conf_device_burst.value;
+}
+
+static ci_uint conf_admission_wait = { .value = 0 };
+
+unsigned int
+conffile_admission_wait(void)
+{
+    return conf_admission_wait.value;
+}
+
+static ci_uint conf_luks_unlock_memory = { .value = 0 };
+
+unsigned int
+conffile_luks_unlock_memory(void)
+{
+    return conf_luks_unlock_memory.value;
+}
+
+static ci_uint conf_overlay_size = { .value = 256 };
+
+unsigned int
+conffile_overlay_size(void)
+{
+    return conf_overlay_size.value;
+}
+
 static cf_spec config[] = {
     { .base = "fsck", .type = boolean_item, .boolean_item = &conf_allow_fsck },
     { .base = "not_physically_logged",
       .type = boolean_item,
       .boolean_item = &conf_allow_not_physically_logged },
+    { .base = "idmap",
+      .type = boolean_item,
+      .boolean_item = &conf_allow_idmap },
+    { .base = "drop_cache",
+      .type = boolean_item,
+      .boolean_item = &conf_allow_drop_cache },
+    { .base = "overlay",
+      .type = boolean_item,
+      .boolean_item = &conf_allow_overlay },
     { .base = "loop", .type = boolean_item, .boolean_item = &conf_allow_loop },
     { .base = "loop_devices",
       .type = string_list,
       .string_list = &conf_loop_devices },
+    { .base = "fsck_sched",
+      .type = string_list,
+      .string_list = &conf_fsck_sched },
+    { .base = "cryptsetup_sched",
+      .type = string_list,
+      .string_list = &conf_cryptsetup_sched },
+    { .base = "mount_sched",
+      .type = string_list,
+      .string_list = &conf_mount_sched },
+    { .base = "trim_buses",
+      .type = string_list,
+      .string_list = &conf_trim_buses },
+    { .base = "max_mounts",
+      .type = uint_item,
+      .uint_item = &conf_max_mounts },
+    { .base = "max_mounts_per_user",
+      .type = uint_item,
+      .uint_item = &conf_max_mounts_per_user },
+    { .base = "device_rate",
+      .type = uint_item,
+      .uint_item = &conf_device_rate },
+    { .base = "device_burst",
+      .type = uint_item,
+      .uint_item = &conf_device_burst },
+    { .base = "admission_wait",
+      .type = uint_item,
+      .uint_item = &conf_admission_wait },
+    { .base = "luks_unlock_memory",
+      .type = uint_item,
+      .uint_item = &conf_luks_unlock_memory },
+    { .base = "overlay_size",
+      .type = uint_item,
+      .uint_item = &conf_overlay_size },
     { .base = NULL },
 };
 
@@ -22,6 +22,29 @@ int conffile_allow_fsck(void);
 */
 int conffile_allow_not_physically_logged(void);
 
+/**
+   Returns true if the user is allowed to request ID-mapped mounts
+*/
+int conffile_allow_idmap(void);
+
+/**
+   Returns true if pumount should drop the page cache of the device (and
+   of the backing file of loop devices) after unmounting it.
+*/
+int conffile_allow_drop_cache(void);
+
+/**
+   Returns true if the user is allowed to request writable overlays on
+   top of read-only mounts
+*/
+int conffile_allow_overlay(void);
+
+/**
+   Return the size limit of the tmpfs of overlays, in MiB. 0 means the
+   tmpfs default, half of the memory.
+*/
+unsigned int conffile_overlay_size(void);
+
 /**
    Returns true if the user is allowed to use pmount/pumount to setup
    loopback devices.
@@ -34,6 +57,48 @@ int conffile_allow_loop(void);
 */
 char **conffile_loop_devices(void);
 
+/**
+   Return the NULL-terminated lists of scheduling items (nice=,
+   ioprio=, cgroup=, memory.max=, io.*=) for fsck, cryptsetup and
+   mount. Can return NULL if the list is empty.
+*/
+char **conffile_fsck_sched(void);
+char **conffile_cryptsetup_sched(void);
+char **conffile_mount_sched(void);
+
+/**
+   Return the buses (usb, mmc...) of the devices that pumount trims by
+   default, or NULL. "all" stands for every device.
+*/
+char **conffile_trim_buses(void);
+
+/**
+   Return the maximum number of mounts in progress at the same time,
+   system-wide and per user. 0 means unlimited.
+*/
+unsigned int conffile_max_mounts(void);
+unsigned int conffile_max_mounts_per_user(void);
+
+/**
+   Return the number of mounts per minute a single device may sustain
+   (0 means unlimited), and how many it may do in a row.
+*/
+unsigned int conffile_device_rate(void);
+unsigned int conffile_device_burst(void);
+
+/**
+   Return how many seconds a mount may wait for admission before being
+   rejected.
+*/
+unsigned int conffile_admission_wait(void);
+
+/**
+   Return how many MiB of memory the key derivation of LUKS devices
+   unlocked together may use at once. 0 means half of the available
+   memory.
+*/
+unsigned int conffile_luks_unlock_memory(void);
+
 /**
    Reads configuration information from the given file into the
    structure.
@@ -0,0 +1,145 @@
+/**
+ * device.c -- block devices opened once for a whole mount
+ *
+ * This software is distributed under the terms and conditions of the
+ * GNU General Public License. See file GPL for the full text of the license.
+ */
+
+#define _GNU_SOURCE
+#include "config.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <libintl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#include "device.h"
+#include "utils.h"
+
+/**
+   Finds the whole disk of dev from its sysfs directory: the parent
+   directory of a partition is its disk.
+ */
+static void
+device_find_disk(struct device_handle *dev)
+{
+    unsigned int major, minor;
+    FILE *f;
+    int fd;
+
+    dev->disk = dev->rdev;
+    if(faccessat(dev->sysfs_fd, "partition", F_OK, 0))
+        return;
+    fd = openat(dev->sysfs_fd, "../dev", O_RDONLY | O_CLOEXEC);
+    if(fd < 0 || !(f = fdopen(fd, "r"))) {
+        if(fd >= 0)
+            close(fd);
+        return;
+    }
+    if(fscanf(f, "%u:%u", &major, &minor) == 2)
+        dev->disk = makedev(major, minor);
+    fclose(f);
+}
+
+int
+device_open(struct device_handle *dev, const char *path)
+{
+    struct stat st;
+    char sysfs[64];
+    int path_fd, saved_errno;
+
+    dev->path = path;
+    dev->fd = dev->sysfs_fd = -1;
+    dev->rdev = dev->disk = 0;
+    dev->sysdir = NULL;
+    *dev->proc_path = 0;
+
+    /* O_PATH does not open the device itself: what is not a block
+       device is left alone */
+    path_fd = open(path, O_PATH | O_CLOEXEC);
+    if(path_fd < 0) {
+        fprintf(stderr, _("Error: device %s does not exist\n"), path);
+        return -1;
+    }
+    if(fstat(path_fd, &st) || !S_ISBLK(st.st_mode)) {
+        fprintf(stderr, _("Error: %s is not a block device\n"), path);
+        close(path_fd);
+        return -1;
+    }
+    dev->rdev = st.st_rdev;
+
+    /* through the descriptor, not the node, which may have changed */
+    snprintf(dev->proc_path, sizeof(dev->proc_path), "/proc/self/fd/%d",
+             path_fd);
+    get_root();
+    dev->fd = open(dev->proc_path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    saved_errno = errno;
+    drop_root();
+    close(path_fd);
+    if(dev->fd < 0) {
+        fprintf(stderr, _("Error: could not open %s: %s\n"), path,
+                strerror(saved_errno));
+        *dev->proc_path = 0;
+        return -1;
+    }
+    snprintf(dev->proc_path, sizeof(dev->proc_path), "/proc/self/fd/%d",
+             dev->fd);
+
+    snprintf(sysfs, sizeof(sysfs), "/sys/dev/block/%u:%u", major(dev->rdev),
+             minor(dev->rdev));
+    dev->sysfs_fd = open(sysfs, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(dev->sysfs_fd < 0)
+        debug("%s: %s\n", sysfs, strerror(errno));
+    else
+        device_find_disk(dev);
+    if(dev->disk &&
+       asprintf(&dev->sysdir, "/sys/dev/block/%u:%u", major(dev->disk),
+                minor(dev->disk)) == -1) {
+        perror("asprintf");
+        exit(E_INTERNAL);
+    }
+    debug("opened %s (%u:%u) as %s, its disk is %s\n", path,
+          major(dev->rdev), minor(dev->rdev), dev->proc_path,
+          dev->sysdir ? dev->sysdir : "unknown");
+    return 0;
+}
+
+void
+device_close(struct device_handle *dev)
+{
+    if(dev->fd >= 0)
+        close(dev->fd);
+    if(dev->sysfs_fd >= 0)
+        close(dev->sysfs_fd);
+    free(dev->sysdir);
+    dev->fd = dev->sysfs_fd = -1;
+    dev->sysdir = NULL;
+}
+
+void
+device_inherit(struct device_handle *dev, int inherit)
+{
+    if(dev->fd >= 0 &&
+       fcntl(dev->fd, F_SETFD, inherit ? 0 : FD_CLOEXEC) == -1)
+        debug("fcntl(%s): %s\n", dev->proc_path, strerror(errno));
+}
+
+int
+device_has_medium(const struct device_handle *dev)
+{
+    uint64_t size;
+
+    if(ioctl(dev->fd, BLKGETSIZE64, &size)) {
+        debug("BLKGETSIZE64(%s): %s\n", dev->path, strerror(errno));
+        /* let the mount say what is wrong */
+        return 1;
+    }
+    return size > 0;
+}
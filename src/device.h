@@ -0,0 +1,55 @@
+/**
+ * @file device.h - block devices opened once for a whole mount
+ *
+ * This software is distributed under the terms and conditions of the
+ * GNU General Public License. See file GPL for the full text of the license.
+ */
+
+#ifndef __device_h
+#define __device_h
+
+#include <sys/types.h>
+
+/**
+   A block device looked up once: the policy checks, the detection, the
+   LUKS setup and the helpers all act on the device that was found then,
+   whatever happens to its node afterwards.
+ */
+struct device_handle {
+    const char *path;    /* the node it was opened from, not owned */
+    int fd;              /* opened read-only and non-blocking, or -1 */
+    dev_t rdev;
+    dev_t disk;          /* the whole disk, rdev itself unless a partition */
+    int sysfs_fd;        /* /sys/dev/block/<major>:<minor>, or -1 */
+    char *sysdir;        /* /sys/dev/block/ directory of disk */
+    char proc_path[32];  /* /proc/self/fd/<fd>, to open it again */
+};
+
+/**
+   Opens the block device at path (as root), after checking that it is
+   one, and looks up its sysfs directories. Reading it does not wait for
+   a medium; see device_has_medium().
+
+   @return 0 on success, -1 if path is not a block device or cannot be
+   opened (the error is printed), in which case fd is -1
+ */
+int device_open(struct device_handle *dev, const char *path);
+
+/**
+   Closes what device_open() opened. Can be called more than once.
+ */
+void device_close(struct device_handle *dev);
+
+/**
+   Lets the helpers spawned from now on open proc_path (inherit true),
+   or stops them from inheriting the device.
+ */
+void device_inherit(struct device_handle *dev, int inherit);
+
+/**
+   Returns whether there is a medium in the device, that is, whether it
+   has a size.
+ */
+int device_has_medium(const struct device_handle *dev);
+
+#endif
@@ -8,10 +8,15 @@
  * GNU General Public License. See file GPL for the full text of the license.
  */
 
-#include "fs.h"
-
+#define _GNU_SOURCE
+#include "config.h"
+#include <libintl.h>
+#include <stdio.h>
 #include <string.h>
 
+#include "fs.h"
+#include "utils.h"
+
 /**
  * List of file systems supported by pmount; terminated with a struct with
  * fsname == NULL;
@@ -172,6 +177,24 @@ static struct FS supported_fs[] = {
         .fdmask = NULL,
         .skip_autodetect = 0,
     },
+    {
+        .fsname = "squashfs",
+        .options = "nodev,noauto,nosuid,user,ro",
+        .support_ugid = 0,
+        .umask = NULL,
+        .iocharset_format = NULL,
+        .fdmask = NULL,
+        .skip_autodetect = 0,
+    },
+    {
+        .fsname = "erofs",
+        .options = "nodev,noauto,nosuid,user,ro",
+        .support_ugid = 0,
+        .umask = NULL,
+        .iocharset_format = NULL,
+        .fdmask = NULL,
+        .skip_autodetect = 0,
+    },
     {
         .fsname = "ntfs",
         .options = "nosuid,nodev,user",
@@ -220,3 +243,157 @@ get_fs_info(const char *fsname)
             return i;
     return NULL;
 }
+
+const struct FS *
+fs_mount_options(const char *fsname, const struct mount_request *request,
+                 char *mount_opts, size_t size)
+{
+    const struct FS *fs;
+    char ugid_opt[100];
+    char umask_opt[100];
+    char fdmask_opt[100];
+    char iocharset_opt[100];
+    const char *utc_opt = "";
+    const char *sync_opt = ",sync";
+    const char *atime_opt = ",atime";
+    const char *exec_opt = ",noexec";
+    const char *access_opt = NULL;
+    const char *selinux_context_opt = "";
+
+    /* check and retrieve option information for requested file system */
+    if(!fsname) {
+        fputs(_("Internal error: mount_attempt: given file system name is "
+                "NULL\n"),
+              stderr);
+        return NULL;
+    }
+
+    fs = get_fs_info(fsname);
+    if(!fs) {
+        fprintf(stderr, _("Error: invalid file system name '%s'\n"), fsname);
+        return NULL;
+    }
+
+    /* validate user specified masks */
+    if(request->umask && parse_unsigned(request->umask, E_ARGS) > 0777) {
+        fprintf(stderr, _("Error: invalid umask %s\n"), request->umask);
+        return NULL;
+    }
+
+    if(request->fmask && parse_unsigned(request->fmask, E_ARGS) > 0777) {
+        fprintf(stderr, _("Error: invalid fmask %s\n"), request->fmask);
+        return NULL;
+    }
+
+    if(request->dmask && parse_unsigned(request->dmask, E_ARGS) > 0777) {
+        fprintf(stderr, _("Error: invalid dmask %s\n"), request->dmask);
+        return NULL;
+    }
+
+    /* assemble option string */
+    *ugid_opt = *umask_opt = *fdmask_opt = *iocharset_opt = 0;
+    if(fs->support_ugid)
+        snprintf(ugid_opt, sizeof(ugid_opt), ",uid=%u,gid=%u", request->uid,
+                 request->gid);
+
+    if(fs->umask)
+        snprintf(umask_opt, sizeof(umask_opt), ",umask=%s",
+                 request->umask ? request->umask : fs->umask);
+    /* If the fs supports fdmasks, we try to make some values
+       up.
+    */
+    if(fs->umask && fs->fdmask) {
+        /* We deal with masks in another way now: */
+        unsigned i_umask, i_dmask, i_fmask;
+
+        /* We first get the umask value */
+        if(request->umask)
+            i_umask =
+                parse_unsigned(request->umask, E_ARGS); /* shouldn't fail */
+        else
+            i_umask = parse_unsigned(fs->umask, E_ARGS); /* shouldn't fail */
+
+        /* Now the fmask */
+        if(request->fmask)
+            i_fmask =
+                parse_unsigned(request->fmask, E_ARGS); /* shouldn't fail */
+        else                          /* make up from the umask parameter */
+            i_fmask = i_umask | 0111; /* remove exec permissions */
+        /* And the dmask */
+        if(request->dmask)
+            i_dmask =
+                parse_unsigned(request->dmask, E_ARGS); /* shouldn't fail */
+        else                   /* make up from the umask parameter */
+            i_dmask = i_umask; /* same as umask */
+        snprintf(fdmask_opt, sizeof(fdmask_opt), fs->fdmask, i_fmask, i_dmask);
+    }
+
+    if(request->async)
+        sync_opt = ",async";
+
+    if(request->noatime)
+        atime_opt = ",noatime";
+
+    if(request->exec)
+        exec_opt = ",exec";
+
+    if(request->access == FS_ACCESS_RO)
+        access_opt = ",ro";
+    else if(request->access == FS_ACCESS_RW)
+        access_opt = ",rw";
+    else
+        access_opt = "";
+
+    if(request->selinux_context)
+        selinux_context_opt = ",context=system_u:object_r:removable_t:s0";
+
+    if(!strcmp(fsname, "vfat") && request->utc)
+        utc_opt = ",tz=UTC";
+
+    if(request->iocharset && fs->iocharset_format) {
+        if(!is_word_str(request->iocharset)) {
+            fprintf(stderr, _("Error: invalid charset name '%s'\n"),
+                    request->iocharset);
+            return NULL;
+        }
+        /* VFAT and UTF-8 need special care, see bug #443514 and mount(1) */
+        if(!strcmp(fsname, "vfat") && request->utf8) {
+            debug("VFAT in a UTF-8 locale: using option utf8\n");
+            if(!strcmp(request->iocharset, "utf8")) {
+                debug(
+                    "filesystem is vfat and charset is utf-8: using iso8859-1\n"
+                    "You can change with the -c option");
+                snprintf(iocharset_opt, sizeof(iocharset_opt), "%s",
+                         request->iso8859_1 ? ",utf8,iocharset=iso8859-1"
+                                            : ",utf8");
+            } else {
+                snprintf(iocharset_opt, sizeof(iocharset_opt),
+                         ",utf8,iocharset=%s", request->iocharset);
+            }
+        } else {
+            snprintf(iocharset_opt, sizeof(iocharset_opt), fs->iocharset_format,
+                     request->iocharset);
+        }
+    } else if(!strcmp(fsname, "vfat") && fs->iocharset_format) {
+        /* We still make a special case for vfat, as in certain cases,
+           mount will mount it with iocharset=utf8, some times without
+           warning. So, in the absence of a specified charset, we
+           force iocharset=iso8859-1, if the kernel has it */
+        if(request->iso8859_1)
+            snprintf(iocharset_opt, sizeof(iocharset_opt), fs->iocharset_format,
+                     "iso8859-1");
+        /* the utf8 option needs no NLS table, keep it if the charset was
+           dropped */
+        if(request->utf8)
+            strncat(iocharset_opt, ",utf8",
+                    sizeof(iocharset_opt) - strlen(iocharset_opt) - 1);
+    }
+
+    snprintf(mount_opts, size, "%s%s%s%s%s%s%s%s%s%s%s%s%s",
+             fs->options, sync_opt, atime_opt, exec_opt, access_opt, ugid_opt,
+             umask_opt, fdmask_opt, iocharset_opt, utc_opt,
+             selinux_context_opt, request->extra ? "," : "",
+             request->extra ? request->extra : "");
+
+    return fs;
+}
@@ -13,6 +13,8 @@
 #ifndef __fs_h
 #define __fs_h
 
+#include <stddef.h>
+
 /**
  * Structure with information about a supported file system
  */
@@ -36,6 +38,50 @@ struct FS {
     int skip_autodetect;
 };
 
+/** Access mode asked for a mount */
+enum fs_access { FS_ACCESS_DEFAULT, FS_ACCESS_RO, FS_ACCESS_RW };
+
+/**
+ * The options asked for a mount, from which fs_mount_options() builds the
+ * option string of a file system
+ */
+struct mount_request {
+    /** I/O character set, NULL for the default */
+    const char *iocharset;
+    /** Masks, NULL for the defaults of the file system */
+    const char *umask, *fmask, *dmask;
+    /** Whether to mount with async rather than sync */
+    int async;
+    int noatime;
+    int exec;
+    enum fs_access access;
+    /** Whether to mount with the SELinux context of removable media */
+    int selinux_context;
+    /** Whether the timestamps of vfat are in UTC rather than local time */
+    int utc;
+    /** Whether the locale uses UTF-8 */
+    int utf8;
+    /** Whether the kernel has the iso8859-1 NLS table (only used for
+        vfat) */
+    int iso8859_1;
+    /** Owner of the files, for file systems with uid and gid options */
+    unsigned uid, gid;
+    /** Options appended as they are, or NULL */
+    const char *extra;
+};
+
+/**
+ * Assemble the mount options of the given file system for request.
+ * @param fsname file system name (mount option -t)
+ * @param mount_opts buffer for the option string
+ * @param size size of mount_opts
+ * @return the file system information, or NULL if fsname or the options are
+ *         invalid (message is printed in this case)
+ */
+const struct FS *fs_mount_options(const char *fsname,
+                                  const struct mount_request *request,
+                                  char *mount_opts, size_t size);
+
 /**
  * Return the information struct for a given file system, or NULL if the file
  * system is unknown. The returned pointer points to static data, do not free()
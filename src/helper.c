@@ -0,0 +1,289 @@
+/**
+ * helper.c -- scheduling policy of the helper programs
+ *
+ * This software is distributed under the terms and conditions of the
+ * GNU General Public License. See file GPL for the full text of the license.
+ */
+
+#define _GNU_SOURCE
+#include "config.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <libintl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#include "configuration.h"
+#include "helper.h"
+#include "utils.h"
+
+/* From linux/ioprio.h, which is not shipped by every libc */
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_RT 1
+#define IOPRIO_CLASS_BE 2
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_WHO_PROCESS 1
+
+/* From linux/magic.h */
+#define CGROUP2_SUPER_MAGIC 0x63677270
+
+/* The whole disk the helpers work on, for io.max */
+static dev_t helper_disk = 0;
+
+void
+helper_set_device(const struct device_handle *dev)
+{
+    /* The io controller only accepts whole disks */
+    helper_disk = dev->disk;
+}
+
+/**
+   Returns the scheduling items configured for the helper at path, or
+   NULL.
+ */
+static char **
+helper_sched_items(const char *path)
+{
+    if(!strcmp(path, FSCKPROG))
+        return conffile_fsck_sched();
+    if(!strcmp(path, CRYPTSETUPPROG))
+        return conffile_cryptsetup_sched();
+    if(!strcmp(path, MOUNTPROG))
+        return conffile_mount_sched();
+    return NULL;
+}
+
+/**
+   Writes value into the file dir/file.
+
+   @return 0 on success, and the errno value on failure.
+ */
+static int
+helper_cgroup_write(const char *dir, const char *file, const char *value)
+{
+    ssize_t len = strlen(value);
+    char *path;
+    int fd, rc = 0;
+
+    if(asprintf(&path, "%s/%s", dir, file) < 0)
+        return ENOMEM;
+    fd = open(path, O_WRONLY | O_CLOEXEC);
+    free(path);
+    if(fd < 0)
+        return errno;
+    if(write(fd, value, len) != len)
+        rc = errno;
+    close(fd);
+    return rc;
+}
+
+/**
+   Sets the limit file of the cgroup dir to value. If the file does
+   not exist, tries to enable the controller for dir in the
+   cgroup.subtree_control of its parent first, which works when the
+   parent is delegated to us.
+ */
+static void
+helper_cgroup_limit(const char *dir, const char *file, const char *value,
+                    const char *controller)
+{
+    char *parent, *enable;
+    int rc;
+
+    rc = helper_cgroup_write(dir, file, value);
+    if(rc == ENOENT) {
+        parent = strndup(dir, strrchr(dir, '/') - dir);
+        if(!parent || asprintf(&enable, "+%s", controller) < 0) {
+            free(parent);
+            return;
+        }
+        rc = helper_cgroup_write(parent, "cgroup.subtree_control", enable);
+        if(rc)
+            debug("could not enable the %s controller in %s: %s\n",
+                  controller, parent, strerror(rc));
+        else
+            rc = helper_cgroup_write(dir, file, value);
+        free(enable);
+        free(parent);
+    }
+    if(rc)
+        debug("could not set %s/%s to '%s': %s\n", dir, file, value,
+              strerror(rc));
+}
+
+/**
+   Moves the calling process into the cgroup CGROUP_ROOT/cgroup,
+   creating it if needed, after setting its limits.
+ */
+static void
+helper_join_cgroup(const char *cgroup, const char *memory_max,
+                   const char *io_max)
+{
+    struct statfs sfs;
+    char *dir;
+    int rc;
+
+    if(statfs(CGROUP_ROOT, &sfs) || sfs.f_type != CGROUP2_SUPER_MAGIC) {
+        debug("%s is not a cgroup v2 hierarchy, not joining %s\n",
+              CGROUP_ROOT, cgroup);
+        return;
+    }
+    if(cgroup[0] == '/' || strstr(cgroup, "..")) {
+        fprintf(stderr,
+                _("Warning: ignoring the invalid cgroup path '%s'\n"), cgroup);
+        return;
+    }
+    if(asprintf(&dir, "%s/%s", CGROUP_ROOT, cgroup) < 0)
+        return;
+    /* Create the missing levels of the path, one by one */
+    for(char *slash = dir + strlen(CGROUP_ROOT); slash;) {
+        slash = strchr(slash + 1, '/');
+        if(slash)
+            *slash = 0;
+        rc = mkdir(dir, 0755) && errno != EEXIST ? errno : 0;
+        if(slash)
+            *slash = '/';
+        if(rc) {
+            debug("could not create cgroup %s: %s\n", dir, strerror(rc));
+            free(dir);
+            return;
+        }
+    }
+
+    if(memory_max)
+        helper_cgroup_limit(dir, "memory.max", memory_max, "memory");
+    if(io_max)
+        helper_cgroup_limit(dir, "io.max", io_max, "io");
+
+    /* Writing 0 moves the writer itself */
+    rc = helper_cgroup_write(dir, "cgroup.procs", "0");
+    if(rc)
+        debug("could not join cgroup %s: %s\n", dir, strerror(rc));
+    free(dir);
+}
+
+/**
+   Parses an ioprio= value: idle, best-effort[:level] or
+   realtime[:level], with a level from 0 (highest) to 7.
+
+   @return the ioprio value, or -1 if value is invalid.
+ */
+static int
+helper_parse_ioprio(const char *value)
+{
+    static const struct {
+        const char *name;
+        int class;
+    } classes[] = {
+        { "idle", IOPRIO_CLASS_IDLE },
+        { "best-effort", IOPRIO_CLASS_BE },
+        { "realtime", IOPRIO_CLASS_RT },
+        { NULL, 0 },
+    };
+    size_t len = strcspn(value, ":");
+    int level = 4;
+    char *end;
+
+    if(value[len] == ':') {
+        level = strtol(value + len + 1, &end, 10);
+        if(*end || end == value + len + 1 || level < 0 || level > 7)
+            return -1;
+    }
+    for(int i = 0; classes[i].name; i++)
+        if(strlen(classes[i].name) == len &&
+           !strncmp(value, classes[i].name, len)) {
+            if(classes[i].class == IOPRIO_CLASS_IDLE)
+                level = 0;
+            return classes[i].class << IOPRIO_CLASS_SHIFT | level;
+        }
+    return -1;
+}
+
+/**
+   Appends " key=value" to the io.max line of the device set by
+   helper_set_device().
+ */
+static void
+helper_add_io_limit(char *io_max, size_t size, const char *key,
+                    const char *value)
+{
+    size_t len = strlen(io_max);
+
+    if(!len)
+        len = snprintf(io_max, size, "%u:%u", major(helper_disk),
+                       minor(helper_disk));
+    if(len < size)
+        snprintf(io_max + len, size - len, " %s=%s", key, value);
+}
+
+void
+helper_apply_sched(const char *path)
+{
+    char **items = helper_sched_items(path);
+    const char *cgroup = NULL, *memory_max = NULL;
+    char io_max[128] = "";
+    int nice_value = 0, has_nice = 0, ioprio = -1;
+    char *end;
+
+    for(; items && *items; items++) {
+        char *item = *items;
+        char *value = strchr(item, '=');
+        if(!value) {
+            fprintf(stderr,
+                    _("Warning: ignoring the invalid scheduling item '%s'\n"),
+                    item);
+            continue;
+        }
+        *value++ = 0; /* We are in the child, it can be clobbered */
+
+        if(!strcmp(item, "nice")) {
+            nice_value = strtol(value, &end, 10);
+            has_nice = !*end && end != value && nice_value >= -20 &&
+                       nice_value <= 19;
+            if(!has_nice)
+                fprintf(stderr, _("Warning: invalid nice value '%s'\n"),
+                        value);
+        } else if(!strcmp(item, "ioprio")) {
+            ioprio = helper_parse_ioprio(value);
+            if(ioprio < 0)
+                fprintf(stderr, _("Warning: invalid I/O priority '%s'\n"),
+                        value);
+        } else if(!strcmp(item, "cgroup"))
+            cgroup = value;
+        else if(!strcmp(item, "memory.max"))
+            memory_max = value;
+        else if(!strncmp(item, "io.", 3)) {
+            if(helper_disk)
+                helper_add_io_limit(io_max, sizeof(io_max), item + 3, value);
+            else
+                debug("no block device to apply %s to\n", item);
+        } else
+            fprintf(stderr,
+                    _("Warning: ignoring the unknown scheduling item '%s'\n"),
+                    item);
+    }
+
+    if(cgroup)
+        helper_join_cgroup(cgroup, memory_max, io_max[0] ? io_max : NULL);
+    else if(memory_max || io_max[0])
+        debug("memory.max and io.* limits need a cgroup= item\n");
+
+    if(has_nice && setpriority(PRIO_PROCESS, 0, nice_value))
+        debug("could not set the nice value of %s to %d: %s\n", path,
+              nice_value, strerror(errno));
+
+    if(ioprio >= 0 &&
+       syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, ioprio) < 0)
+        debug("could not set the I/O priority of %s: %s\n", path,
+              strerror(errno));
+
+    /* exec() would discard the debug messages */
+    fflush(stdout);
+}
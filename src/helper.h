@@ -0,0 +1,37 @@
+/**
+ * @file helper.h - scheduling policy of the helper programs
+ *
+ * This software is distributed under the terms and conditions of the
+ * GNU General Public License. See file GPL for the full text of the license.
+ */
+
+#ifndef __helper_h
+#define __helper_h
+
+#include "device.h"
+
+/**
+   Root of the cgroup v2 hierarchy; the cgroup= scheduling items are
+   relative to it.
+ */
+#define CGROUP_ROOT "/sys/fs/cgroup"
+
+/**
+   Sets the block device the helpers work on, so that io.max limits
+   can be applied to the disk it belongs to.
+ */
+void helper_set_device(const struct device_handle *dev);
+
+/**
+   Applies to the calling process the scheduling policy configured for
+   the helper program found at path (fsck_sched, cryptsetup_sched or
+   mount_sched in the configuration file): nice value, I/O priority,
+   and placement into a cgroup with memory.max and io.max limits.
+
+   This is meant to be called in the child process right before
+   exec. Every step that fails is reported with debug() and skipped,
+   so that the helper still runs, with the default scheduling.
+ */
+void helper_apply_sched(const char *path);
+
+#endif
@@ -0,0 +1,223 @@
+/**
+ * ident.c -- resolution of LABEL=, UUID=... device identifiers
+ *
+ * This software is distributed under the terms and conditions of the
+ * GNU General Public License. See file GPL for the full text of the license.
+ */
+
+#define _GNU_SOURCE
+#include "config.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <libintl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_BLKID
+#include <blkid.h>
+#endif
+
+#include "ident.h"
+#include "policy.h"
+#include "utils.h"
+
+static const struct {
+    const char *prefix; /* as given on the command line */
+    const char *dir;    /* directory of the udev symlinks */
+    const char *tag;    /* libblkid value for probing, NULL if none */
+    int by_bus;         /* whether the links are prefixed by the bus */
+} ident_forms[] = {
+    { "LABEL=", "/dev/disk/by-label/", "LABEL", 0 },
+    { "UUID=", "/dev/disk/by-uuid/", "UUID", 0 },
+    { "PARTUUID=", "/dev/disk/by-partuuid/", "PART_ENTRY_UUID", 0 },
+    { "ID_SERIAL=", "/dev/disk/by-id/", NULL, 1 },
+    { NULL, NULL, NULL, 0 },
+};
+
+/**
+   Bus prefixes of the /dev/disk/by-id links, which are named
+   <bus>-<ID_SERIAL>.
+ */
+static const char *ident_serial_buses[] = {
+    "usb", "ata", "scsi", "nvme", "mmc", "ieee1394", "memstick", NULL,
+};
+
+/**
+   Encodes value the way udev names the /dev/disk/by-* symlinks: the
+   bytes that are not safe in a file name, starting with '/', are
+   written as \xNN.
+ */
+static char *
+ident_encode(const char *value)
+{
+    char *encoded = malloc(4 * strlen(value) + 1);
+    char *e = encoded;
+
+    if(!encoded) {
+        perror("malloc");
+        exit(E_INTERNAL);
+    }
+    for(const unsigned char *v = (const unsigned char *)value; *v; v++) {
+        if(isalnum(*v) || strchr("#+-.:=@_", *v) || *v >= 0x80)
+            *e++ = *v;
+        else
+            e += sprintf(e, "\\x%02x", *v);
+    }
+    *e = 0;
+    return encoded;
+}
+
+/**
+   Reads the symlink dir/name, and returns the device node it points
+   to (to be freed), or NULL if there is no such link.
+ */
+static char *
+ident_readlink(const char *dir, const char *name)
+{
+    char *link, *node, target[256];
+    const char *t = target;
+    size_t dirlen = strlen(dir) - 1; /* without the trailing / */
+    ssize_t len;
+
+    if(asprintf(&link, "%s%s", dir, name) == -1) {
+        perror("asprintf");
+        exit(E_INTERNAL);
+    }
+    len = readlink(link, target, sizeof(target) - 1);
+    if(len < 0)
+        debug("ident_readlink: %s: %s\n", link, strerror(errno));
+    free(link);
+    if(len < 0 || len == sizeof(target) - 1)
+        return NULL;
+    target[len] = 0;
+
+    if(*t == '/')
+        return strdup(t);
+
+    /* udev links are relative, like ../../sdb1 */
+    while(!strncmp(t, "../", 3)) {
+        while(dirlen > 0 && dir[dirlen - 1] != '/')
+            dirlen--;
+        if(dirlen > 0)
+            dirlen--;
+        t += 3;
+    }
+    if(asprintf(&node, "%.*s/%s", (int)dirlen, dir, t) == -1) {
+        perror("asprintf");
+        exit(E_INTERNAL);
+    }
+    return node;
+}
+
+/**
+   Looks for a removable block device whose tag (as named by libblkid)
+   has the given value.
+
+   @return the device node (to be freed), or NULL if none matched
+ */
+static char *
+ident_probe_removable(const char *tag, const char *value)
+{
+    char *found = NULL;
+#ifdef HAVE_BLKID
+    DIR *dir;
+    struct dirent *ent;
+
+    debug("probing removable devices for %s=%s\n", tag, value);
+    dir = opendir("/sys/class/block");
+    if(!dir) {
+        perror("opendir(/sys/class/block)");
+        return NULL;
+    }
+
+    while(!found && (ent = readdir(dir))) {
+        blkid_probe pr;
+        const char *data;
+        char *node;
+
+        if(ent->d_name[0] == '.')
+            continue;
+        if(asprintf(&node, DEVDIR "%s", ent->d_name) == -1) {
+            perror("asprintf");
+            break;
+        }
+        if(!device_removable_silent(node)) {
+            free(node);
+            continue;
+        }
+
+        get_root();
+        pr = blkid_new_probe_from_filename(node);
+        drop_root();
+        if(pr) {
+            blkid_probe_enable_superblocks(pr, 1);
+            blkid_probe_set_superblocks_flags(pr, BLKID_SUBLKS_LABEL |
+                                                      BLKID_SUBLKS_UUID);
+            blkid_probe_enable_partitions(pr, 1);
+            blkid_probe_set_partitions_flags(pr, BLKID_PARTS_ENTRY_DETAILS);
+            if(!blkid_do_safeprobe(pr) &&
+               !blkid_probe_lookup_value(pr, tag, &data, NULL) &&
+               !strcmp(data, value))
+                found = node;
+            blkid_free_probe(pr);
+        }
+        if(found != node)
+            free(node);
+    }
+    closedir(dir);
+#else
+    (void)tag;
+    (void)value;
+#endif /* HAVE_BLKID */
+    return found;
+}
+
+int
+ident_resolve(const char *arg, char **device)
+{
+    const char *value;
+    char *encoded, *name;
+    int i;
+
+    for(i = 0; ident_forms[i].prefix; i++)
+        if(!strncmp(arg, ident_forms[i].prefix,
+                    strlen(ident_forms[i].prefix)))
+            break;
+    if(!ident_forms[i].prefix)
+        return 0;
+
+    value = arg + strlen(ident_forms[i].prefix);
+    if(!*value) {
+        fprintf(stderr, _("Error: empty device identifier %s\n"), arg);
+        return -1;
+    }
+
+    encoded = ident_encode(value);
+    if(!ident_forms[i].by_bus)
+        *device = ident_readlink(ident_forms[i].dir, encoded);
+    else {
+        *device = NULL;
+        for(const char **bus = ident_serial_buses; !*device && *bus; bus++) {
+            if(asprintf(&name, "%s-%s", *bus, encoded) == -1) {
+                perror("asprintf");
+                exit(E_INTERNAL);
+            }
+            *device = ident_readlink(ident_forms[i].dir, name);
+            free(name);
+        }
+    }
+    free(encoded);
+
+    if(!*device && ident_forms[i].tag)
+        *device = ident_probe_removable(ident_forms[i].tag, value);
+
+    if(!*device) {
+        fprintf(stderr, _("Error: no device found for %s\n"), arg);
+        return -1;
+    }
+    debug("resolved %s to %s\n", arg, *device);
+    return 1;
+}
@@ -0,0 +1,29 @@
+/**
+ * @file ident.h - resolution of LABEL=, UUID=... device identifiers
+ *
+ * This software is distributed under the terms and conditions of the
+ * GNU General Public License. See file GPL for the full text of the license.
+ */
+
+#ifndef __ident_h
+#define __ident_h
+
+/**
+   Resolves a device identifier given as LABEL=label, UUID=uuid,
+   PARTUUID=uuid or ID_SERIAL=serial to a device node.
+
+   The identifier is looked up with a single readlink() of the
+   matching /dev/disk/by-* symlink maintained by udev (for
+   ID_SERIAL=, one per bus prefix of /dev/disk/by-id). If there is no
+   such link, the removable block devices, and only those, are probed
+   with libblkid (when available).
+
+   @param arg the device argument of pmount
+   @param device filled with the device node on success (to be freed)
+   @return 1 if arg was resolved, 0 if arg is not an identifier, and
+   -1 if it is one that matches no device (message is printed in this
+   case)
+ */
+int ident_resolve(const char *arg, char **device);
+
+#endif
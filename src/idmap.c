@@ -0,0 +1,187 @@
+/**
+ * idmap.c -- ID-mapped mounts for file systems without uid= options
+ *
+ * This software is distributed under the terms and conditions of the
+ * GNU General Public License. See file GPL for the full text of the license.
+ */
+
+#define _GNU_SOURCE
+#include "config.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <libintl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#if HAVE_MOUNT_SETATTR
+#include <sched.h>
+#include <sys/mount.h>
+#endif
+
+#include "idmap.h"
+#include "utils.h"
+
+#if HAVE_MOUNT_SETATTR
+
+/**
+   Writes a single-line id map into /proc/<pid>/<file>.
+ */
+static int
+idmap_write_map(pid_t pid, const char *file, unsigned from, unsigned to)
+{
+    char path[64], map[64];
+    int fd, len, rc = 0;
+
+    snprintf(path, sizeof(path), "/proc/%d/%s", pid, file);
+    len = snprintf(map, sizeof(map), "%u %u 1\n", from, to);
+    fd = open(path, O_WRONLY);
+    if(fd < 0 || write(fd, map, len) != len) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        rc = -1;
+    }
+    if(fd >= 0)
+        close(fd);
+    return rc;
+}
+
+/**
+   Creates a user namespace in which the on-disk ids from_uid and
+   from_gid map to to_uid and to_gid, and returns a file descriptor
+   to it, or -1 on failure. Must be called as root.
+ */
+static int
+idmap_userns_fd(uid_t from_uid, gid_t from_gid, uid_t to_uid, gid_t to_gid)
+{
+    int sync[2], nsfd = -1;
+    char path[64], c;
+    pid_t pid;
+
+    if(pipe(sync)) {
+        perror("pipe");
+        return -1;
+    }
+
+    pid = fork();
+    if(pid < 0) {
+        perror(_("Impossible to fork"));
+        close(sync[0]);
+        close(sync[1]);
+        return -1;
+    }
+    if(pid == 0) {
+        /* The child only lives to hold the namespace while the parent
+           writes its maps and opens it */
+        close(sync[0]);
+        c = unshare(CLONE_NEWUSER) ? 1 : 0;
+        if(write(sync[1], &c, 1) != 1 || c)
+            _exit(1);
+        pause();
+        _exit(0);
+    }
+
+    close(sync[1]);
+    if(read(sync[0], &c, 1) != 1 || c) {
+        fputs(_("Error: could not create a user namespace\n"), stderr);
+        goto out;
+    }
+
+    if(idmap_write_map(pid, "uid_map", from_uid, to_uid) ||
+       idmap_write_map(pid, "gid_map", from_gid, to_gid))
+        goto out;
+
+    snprintf(path, sizeof(path), "/proc/%d/ns/user", pid);
+    nsfd = open(path, O_RDONLY | O_CLOEXEC);
+    if(nsfd < 0)
+        fprintf(stderr, "open(%s): %s\n", path, strerror(errno));
+
+out:
+    close(sync[0]);
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    return nsfd;
+}
+
+int
+idmap_mount(const char *mntpt)
+{
+    struct mount_attr attr = { 0 };
+    struct stat st;
+    int userns_fd, tree_fd, rc = -1;
+
+    get_root();
+    if(stat(mntpt, &st)) {
+        fprintf(stderr, "stat(%s): %s\n", mntpt, strerror(errno));
+        drop_root();
+        return -1;
+    }
+
+    if(st.st_uid == getuid() && st.st_gid == getgid()) {
+        debug("%s already belongs to the calling user, no ID mapping "
+              "needed\n",
+              mntpt);
+        drop_root();
+        return 0;
+    }
+
+    debug("ID-mapping %u:%u to %u:%u on %s\n", st.st_uid, st.st_gid, getuid(),
+          getgid(), mntpt);
+
+    userns_fd = idmap_userns_fd(st.st_uid, st.st_gid, getuid(), getgid());
+    if(userns_fd < 0) {
+        drop_root();
+        return -1;
+    }
+
+    tree_fd = open_tree(AT_FDCWD, mntpt, OPEN_TREE_CLONE | OPEN_TREE_CLOEXEC);
+    if(tree_fd < 0) {
+        perror("open_tree");
+        goto userns_fd;
+    }
+
+    attr.attr_set = MOUNT_ATTR_IDMAP;
+    attr.userns_fd = userns_fd;
+    if(mount_setattr(tree_fd, "", AT_EMPTY_PATH, &attr, sizeof(attr))) {
+        perror("mount_setattr");
+        goto tree_fd;
+    }
+
+    /* The clone keeps the file system alive: swap it with the original
+       mount */
+    if(umount2(mntpt, MNT_DETACH)) {
+        perror("umount2");
+        goto tree_fd;
+    }
+    if(move_mount(tree_fd, "", AT_FDCWD, mntpt, MOVE_MOUNT_F_EMPTY_PATH)) {
+        perror("move_mount");
+        fputs(_("Error: the file system was lost while setting up the "
+                "ID-mapped mount\n"),
+              stderr);
+        goto tree_fd;
+    }
+    rc = 0;
+
+tree_fd:
+    close(tree_fd);
+userns_fd:
+    close(userns_fd);
+    drop_root();
+    return rc;
+}
+
+#else /* !HAVE_MOUNT_SETATTR */
+
+int
+idmap_mount(const char *mntpt)
+{
+    (void)mntpt;
+    fputs(_("Error: pmount was built without support for ID-mapped "
+            "mounts\n"),
+          stderr);
+    return -1;
+}
+
+#endif /* HAVE_MOUNT_SETATTR */
@@ -0,0 +1,25 @@
+/**
+ * @file idmap.h - ID-mapped mounts for file systems without uid= options
+ *
+ * This software is distributed under the terms and conditions of the
+ * GNU General Public License. See file GPL for the full text of the license.
+ */
+
+#ifndef __idmap_h
+#define __idmap_h
+
+/**
+   Replaces the mount found at mntpt by an ID-mapped clone of it, in
+   which the owner (and group) of the file system root appear as the
+   calling user (and group). Nothing is rewritten on the disk.
+
+   This requires mount_setattr(2) (Linux 5.12) and a file system that
+   supports ID-mapped mounts (ext4, btrfs, xfs, f2fs...).
+
+   Returns 0 on success (or if there was nothing to map), and -1 on
+   errors, in which case the original mount is left in place, unless
+   the clone could not be moved onto mntpt after it was detached.
+ */
+int idmap_mount(const char *mntpt);
+
+#endif
@@ -0,0 +1,207 @@
+/**
+ * iostat.c -- I/O accounting of a mount session
+ *
+ * This software is distributed under the terms and conditions of the
+ * GNU General Public License. See file GPL for the full text of the license.
+ */
+
+#define _GNU_SOURCE
+#include "config.h"
+#include <fcntl.h>
+#include <libintl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "iostat.h"
+#include "utils.h"
+
+/* The counters of the stat file of block devices, see
+   Documentation/block/stat.rst in the kernel sources */
+enum {
+    IO_READS,
+    IO_READ_MERGES,
+    IO_READ_SECTORS,
+    IO_READ_TICKS,
+    IO_WRITES,
+    IO_WRITE_MERGES,
+    IO_WRITE_SECTORS,
+    IO_WRITE_TICKS,
+    IO_IN_FLIGHT,
+    IO_TICKS, /* milliseconds with I/O in flight */
+    IO_QUEUE_TICKS,
+    IO_NB, /* the ones we need; newer kernels have more */
+};
+
+/* stat counts 512-byte sectors, whatever the device */
+#define SECTOR_SIZE 512
+
+struct iostat {
+    double time; /* CLOCK_MONOTONIC, in seconds */
+    unsigned long long counters[IO_NB];
+};
+
+/**
+   Reads the current counters of device.
+
+   @return 0 on success, -1 on error
+ */
+static int
+iostat_read(const char *device, struct iostat *io)
+{
+    struct stat st;
+    struct timespec now;
+    char *path;
+    FILE *f;
+    int n = 0;
+
+    if(stat(device, &st) || !S_ISBLK(st.st_mode))
+        return -1;
+    if(asprintf(&path, "/sys/dev/block/%u:%u/stat", major(st.st_rdev),
+                minor(st.st_rdev)) == -1)
+        return -1;
+    f = fopen(path, "r");
+    free(path);
+    if(!f)
+        return -1;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    io->time = now.tv_sec + now.tv_nsec / 1e9;
+    while(n < IO_NB && fscanf(f, "%llu", &io->counters[n]) == 1)
+        n++;
+    fclose(f);
+    return n == IO_NB ? 0 : -1;
+}
+
+int
+iostat_snapshot(const char *device, const char *mntpt)
+{
+    struct iostat io;
+    char *path;
+    FILE *f;
+    int fd, rc = -1;
+
+    if(iostat_read(device, &io)) {
+        debug("iostat: no block layer counters for %s\n", device);
+        return -1;
+    }
+    if(asprintf(&path, "%s/" IOSTAT_SNAPSHOT, mntpt) == -1)
+        return -1;
+
+    get_root();
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC,
+              0600);
+    drop_root();
+    if(fd >= 0 && (f = fdopen(fd, "w"))) {
+        fprintf(f, "%.6f", io.time);
+        for(int i = 0; i < IO_NB; i++)
+            fprintf(f, " %llu", io.counters[i]);
+        fputc('\n', f);
+        rc = fclose(f) ? -1 : 0;
+    } else if(fd >= 0)
+        close(fd);
+    if(rc)
+        debug("iostat: could not save the counters in %s\n", path);
+    else
+        debug("iostat: saved the counters of %s in %s\n", device, path);
+    free(path);
+    return rc;
+}
+
+/**
+   Reads the snapshot saved by iostat_snapshot().
+
+   @return 0 on success, -1 on error
+ */
+static int
+iostat_load(const char *mntpt, struct iostat *io)
+{
+    char *path;
+    FILE *f;
+    int n = 0;
+
+    if(asprintf(&path, "%s/" IOSTAT_SNAPSHOT, mntpt) == -1)
+        return -1;
+    get_root();
+    f = fopen(path, "r");
+    drop_root();
+    free(path);
+    if(!f)
+        return -1;
+    if(fscanf(f, "%lf", &io->time) == 1)
+        while(n < IO_NB && fscanf(f, "%llu", &io->counters[n]) == 1)
+            n++;
+    fclose(f);
+    return n == IO_NB ? 0 : -1;
+}
+
+/**
+   Formats a number of bytes with a binary unit into buf.
+ */
+static const char *
+iostat_bytes(double bytes, char *buf, size_t size)
+{
+    static const char *units[] = { "B", "KiB", "MiB", "GiB", "TiB" };
+    unsigned int u = 0;
+
+    while(bytes >= 1024 && u < sizeof(units) / sizeof(units[0]) - 1) {
+        bytes /= 1024;
+        u++;
+    }
+    snprintf(buf, size, u ? "%.1f %s" : "%.0f %s", bytes, units[u]);
+    return buf;
+}
+
+void
+iostat_report(const char *device, const char *mntpt, double flush)
+{
+    struct iostat start, end;
+    unsigned long long delta[IO_NB];
+    double read, written, busy;
+    char rbuf[32], wbuf[32], tbuf[32];
+
+    if(iostat_load(mntpt, &start)) {
+        debug("iostat: no counters saved at mount time in %s\n", mntpt);
+        return;
+    }
+    if(iostat_read(device, &end)) {
+        debug("iostat: no block layer counters for %s\n", device);
+        return;
+    }
+    for(int i = 0; i < IO_NB; i++) {
+        /* the counters start over when the device is plugged again */
+        if(i != IO_IN_FLIGHT && end.counters[i] < start.counters[i]) {
+            debug("iostat: the counters of %s were reset, no summary\n",
+                  device);
+            return;
+        }
+        delta[i] = end.counters[i] - start.counters[i];
+    }
+
+    read = (double)delta[IO_READ_SECTORS] * SECTOR_SIZE;
+    written = (double)delta[IO_WRITE_SECTORS] * SECTOR_SIZE;
+    busy = delta[IO_TICKS] / 1000.0;
+
+    debug("iostat: %s: %llu reads (%llu merged) of %llu sectors in %llu ms, "
+          "%llu writes (%llu merged) of %llu sectors in %llu ms, busy for "
+          "%llu ms, %llu ms of queue time, session of %.3f s, unmounted in "
+          "%.3f s\n",
+          device, delta[IO_READS], delta[IO_READ_MERGES],
+          delta[IO_READ_SECTORS], delta[IO_READ_TICKS], delta[IO_WRITES],
+          delta[IO_WRITE_MERGES], delta[IO_WRITE_SECTORS],
+          delta[IO_WRITE_TICKS], delta[IO_TICKS], delta[IO_QUEUE_TICKS],
+          end.time - start.time, flush);
+
+    fprintf(stderr,
+            _("%s: read %s, wrote %s in %.1f s; busy for %.2f s (%s/s), "
+              "unmounted in %.2f s\n"),
+            device, iostat_bytes(read, rbuf, sizeof(rbuf)),
+            iostat_bytes(written, wbuf, sizeof(wbuf)), end.time - start.time,
+            busy,
+            iostat_bytes(busy > 0 ? (read + written) / busy : 0, tbuf,
+                         sizeof(tbuf)),
+            flush);
+}
@@ -0,0 +1,31 @@
+/**
+ * @file iostat.h - I/O accounting of a mount session
+ *
+ * This software is distributed under the terms and conditions of the
+ * GNU General Public License. See file GPL for the full text of the license.
+ */
+
+#ifndef __iostat_h
+#define __iostat_h
+
+/** Name of the snapshot of the I/O counters, in the mount point */
+#define IOSTAT_SNAPSHOT ".pmount_iostat"
+
+/**
+   Saves the block layer counters of device (its sysfs stat file) into
+   the mount point directory, where they are hidden by the mount until
+   pumount reads them back.
+
+   @return 0 on success, -1 on error (reported with debug())
+ */
+int iostat_snapshot(const char *device, const char *mntpt);
+
+/**
+   Compares the counters of device with the snapshot in mntpt (once
+   unmounted), and prints a summary of the session on stderr: data read
+   and written, time spent doing I/O, throughput, and the time unmounting
+   took (flush), in seconds.
+ */
+void iostat_report(const char *device, const char *mntpt, double flush);
+
+#endif
@@ -76,7 +76,7 @@ loopdev_dissociate(const char *device)
 }
 
 int
-loopdev_associate(const char *source, char **target)
+loopdev_associate(const char *source, char **target, int readonly)
 {
     struct stat before;
     const char *device;
@@ -84,7 +84,7 @@ loopdev_associate(const char *source, char **target)
     int result;
     int fd;
 
-    fd = open(source, O_RDWR);
+    fd = open(source, readonly ? O_RDONLY : O_RDWR);
     if(fd == -1) {
         fprintf(stderr, "open(%s): %s\n", source, strerror(errno));
         return -1;
@@ -103,10 +103,22 @@ loopdev_associate(const char *source, char **target)
         return -1;
     }
 
-    if(!(before.st_uid == getuid() &&
-         (before.st_mode & S_IRUSR) && /* readable */
-         (before.st_mode & S_IWUSR)    /* writable */
-         )) {
+    if(readonly) {
+        /* Read-only images may be shared, but nobody except their
+           owner may change them under our feet */
+        if(!((before.st_uid == getuid() || before.st_uid == 0) &&
+             !(before.st_mode & (S_IWGRP | S_IWOTH)))) {
+            fprintf(stderr,
+                    _("For read-only loop mounting, %s must belong to you "
+                      "or to root, and must not be writable by others\n"),
+                    source);
+            close(fd);
+            return -1;
+        }
+    } else if(!(before.st_uid == getuid() &&
+                (before.st_mode & S_IRUSR) && /* readable */
+                (before.st_mode & S_IWUSR)    /* writable */
+                )) {
         fprintf(stderr,
                 _("For loop mounting, you must be the owner of %s and "
                   "have read-write permissions on it\n"),
@@ -127,8 +139,12 @@ loopdev_associate(const char *source, char **target)
        one  */
     snprintf(buffer, sizeof(buffer), "/dev/fd/%d", fd);
 
-    result = spawnl(SPAWN_EROOT, LOSETUPPROG, LOSETUPPROG, device, buffer,
-                    (char *)NULL);
+    if(readonly)
+        result = spawnl(SPAWN_EROOT, LOSETUPPROG, LOSETUPPROG, "-r", device,
+                        buffer, (char *)NULL);
+    else
+        result = spawnl(SPAWN_EROOT, LOSETUPPROG, LOSETUPPROG, device, buffer,
+                        (char *)NULL);
     close(fd); /* Now useless */
 
     if(result) {
@@ -20,13 +20,15 @@
    * that read-write access is allowed
    * that the file hasn't been tampered with during the call to losetup.
 
-   It is safe to call this function with source = target
+   If readonly is true, the file is opened read-only and attached with
+   losetup -r. In that case, read permission is enough, and the file
+   may also belong to root, provided nobody else can write to it.
 
-   @todo maybe implement read-only possibilities ?
+   It is safe to call this function with source = target
 
    Returns 0 on success and -1 on errors.
  */
-int loopdev_associate(const char *source, char **target);
+int loopdev_associate(const char *source, char **target, int readonly);
 
 /**
    Dissociates the given loop device
@@ -10,16 +10,21 @@
 
 #define _GNU_SOURCE
 #include "config.h"
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <libintl.h>
 #include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <termios.h>
 #include <unistd.h>
 
+#include "configuration.h"
 #include "luks.h"
 #include "policy.h"
 #include "utils.h"
@@ -39,9 +44,16 @@
     (SPAWN_EROOT | SPAWN_NO_STDOUT | SPAWN_NO_STDERR)
 #endif
 
+int
+luks_is_encrypted(const char *device)
+{
+    return spawnl(CRYPTSETUP_SPAWN_OPTIONS, CRYPTSETUPPROG, CRYPTSETUPPROG,
+                  "isLuks", device, (char *)NULL) == 0;
+}
+
 enum decrypt_status
-luks_decrypt(const char *device, char **decrypted, const char *password_file,
-             int readonly)
+luks_decrypt(const char *device, const char *node, char **decrypted,
+             const char *password_file, int readonly)
 {
     int status;
     char *label;
@@ -49,9 +61,7 @@ luks_decrypt(const char *device, char **decrypted, const char *password_file,
     struct stat st;
 
     /* check if encrypted */
-    status = spawnl(CRYPTSETUP_SPAWN_OPTIONS, CRYPTSETUPPROG, CRYPTSETUPPROG,
-                    "isLuks", device, (char *)NULL);
-    if(status != 0) {
+    if(!luks_is_encrypted(node)) {
         /* just return device */
         debug("device is not LUKS encrypted, or cryptsetup with LUKS support "
               "is not installed\n");
@@ -79,19 +89,19 @@ luks_decrypt(const char *device, char **decrypted, const char *password_file,
             status =
                 spawnl(CRYPTSETUP_SPAWN_OPTIONS, CRYPTSETUPPROG, CRYPTSETUPPROG,
                        "luksOpen", "--key-file", password_file, "--readonly",
-                       device, label, (char *)NULL);
+                       node, label, (char *)NULL);
         else
             status = spawnl(CRYPTSETUP_SPAWN_OPTIONS, CRYPTSETUPPROG,
                             CRYPTSETUPPROG, "luksOpen", "--key-file",
-                            password_file, device, label, (char *)NULL);
+                            password_file, node, label, (char *)NULL);
     else if(readonly == 1)
         status =
             spawnl(CRYPTSETUP_SPAWN_OPTIONS, CRYPTSETUPPROG, CRYPTSETUPPROG,
-                   "--readonly", "luksOpen", device, label, (char *)NULL);
+                   "--readonly", "luksOpen", node, label, (char *)NULL);
     else
         status =
             spawnl(CRYPTSETUP_SPAWN_OPTIONS, CRYPTSETUPPROG, CRYPTSETUPPROG,
-                   "luksOpen", device, label, (char *)NULL);
+                   "luksOpen", node, label, (char *)NULL);
 
     if(status == 0)
         /* yes, we have a LUKS device */
@@ -107,20 +117,324 @@ luks_decrypt(const char *device, char **decrypted, const char *password_file,
     return result;
 }
 
+/* The largest LUKS2 header, binary header and JSON area included */
+#define LUKS2_HEADER_MAX (4 * 1024 * 1024)
+
+static uint64_t
+be64(const unsigned char *p)
+{
+    uint64_t v = 0;
+
+    for(int i = 0; i < 8; i++)
+        v = v << 8 | p[i];
+    return v;
+}
+
+/**
+   How much memory the key derivation of device takes, from its LUKS
+   header: the largest "memory" of its argon2 keyslots, as all of them
+   may be tried. PBKDF2 (and so LUKS1) needs next to nothing.
+
+   @return the memory in KiB
+ */
+static unsigned long
+luks_kdf_memory(const char *device)
+{
+    unsigned char hdr[16];
+    unsigned long memory = 0;
+    uint64_t size;
+    char *json, *p;
+    int fd;
+
+    get_root();
+    fd = open(device, O_RDONLY | O_CLOEXEC);
+    drop_root();
+    if(fd < 0)
+        return 0;
+    /* magic, version, size of the header and JSON area */
+    if(pread(fd, hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+       memcmp(hdr, "LUKS\xba\xbe\0\2", 8)) {
+        close(fd);
+        return 0;
+    }
+    size = be64(hdr + 8);
+    if(size <= 4096 || size > LUKS2_HEADER_MAX) {
+        close(fd);
+        return 0;
+    }
+    json = malloc(size - 4096 + 1);
+    if(!json) {
+        perror("malloc");
+        exit(E_INTERNAL);
+    }
+    if(pread(fd, json, size - 4096, 4096) == (ssize_t)(size - 4096)) {
+        json[size - 4096] = 0;
+        for(p = json; (p = strstr(p, "\"memory\":")); p++) {
+            unsigned long m = strtoul(p + 9, NULL, 10);
+
+            if(m > memory)
+                memory = m;
+        }
+    }
+    free(json);
+    close(fd);
+    debug("key derivation of %s takes %lu KiB\n", device, memory);
+    return memory;
+}
+
+/**
+   Half of the memory available now, in KiB, or 1 GiB if it is not
+   known.
+ */
+static unsigned long
+luks_default_memory(void)
+{
+    unsigned long available = 0;
+    char line[128];
+    FILE *f = fopen("/proc/meminfo", "re");
+
+    if(f) {
+        while(fgets(line, sizeof(line), f))
+            if(sscanf(line, "MemAvailable: %lu kB", &available) == 1)
+                break;
+        fclose(f);
+    }
+    return available ? available / 2 : 1024 * 1024;
+}
+
+/**
+   Reads a passphrase on the terminal, without echoing it, or from the
+   standard input if there is no terminal.
+
+   @return the passphrase (to be freed), or NULL
+ */
+static char *
+luks_read_passphrase(void)
+{
+    FILE *tty = fopen("/dev/tty", "r+e");
+    FILE *in = tty ? tty : stdin;
+    struct termios saved, noecho;
+    int restore = 0;
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t len;
+
+    if(tty) {
+        fputs(_("Enter the passphrase of the encrypted devices: "), tty);
+        fflush(tty);
+        if(!tcgetattr(fileno(tty), &saved)) {
+            noecho = saved;
+            noecho.c_lflag &= ~ECHO;
+            restore = !tcsetattr(fileno(tty), TCSAFLUSH, &noecho);
+        }
+    }
+    len = getline(&line, &size, in);
+    if(tty) {
+        if(restore)
+            tcsetattr(fileno(tty), TCSAFLUSH, &saved);
+        fputc('\n', tty);
+        fclose(tty);
+    }
+    if(len <= 0) {
+        free(line);
+        return NULL;
+    }
+    if(line[len - 1] == '\n')
+        line[len - 1] = 0;
+    return line;
+}
+
+/**
+   Starts cryptsetup on u, giving it passphrase on a pipe (if not
+   NULL).
+
+   @return its pid, or -1
+ */
+static pid_t
+luks_start_open(struct luks_unlock *u, const char *label,
+                const char *password_file, const char *passphrase,
+                int readonly)
+{
+    char *argv[] = {
+        CRYPTSETUPPROG, "luksOpen", "--key-file",
+        (char *)(password_file ? password_file : "-"),
+        (char *)u->device, (char *)label,
+        readonly ? "--readonly" : NULL, NULL
+    };
+    int fds[2] = { -1, -1 };
+    pid_t pid;
+
+    if(passphrase && pipe2(fds, O_CLOEXEC)) {
+        perror(_("Impossible to setup pipes for subprocess communication"));
+        return -1;
+    }
+    pid = spawn_start(CRYPTSETUP_SPAWN_OPTIONS, fds[0], CRYPTSETUPPROG, argv);
+    if(passphrase) {
+        close(fds[0]);
+        /* short enough for the pipe buffer: no need to wait for a reader */
+        if(pid > 0 &&
+           write(fds[1], passphrase, strlen(passphrase)) !=
+               (ssize_t)strlen(passphrase))
+            perror(_("Error: could not pass the passphrase to cryptsetup"));
+        close(fds[1]);
+    }
+    return pid;
+}
+
 void
-luks_release(const char *device, int force)
+luks_decrypt_many(struct luks_unlock *devices, size_t n,
+                  const char *password_file, int readonly,
+                  unsigned long memory)
 {
-    if(force || luks_has_lockfile(device)) {
-        int status = spawnl(CRYPTSETUP_SPAWN_OPTIONS, CRYPTSETUPPROG,
-                            CRYPTSETUPPROG, "luksClose", device, (char *)NULL);
-        if(status != 0) {
-            fprintf(stderr, "Internal error: cryptsetup luksOpen failed\n");
+    unsigned long *cost = calloc(n, sizeof(*cost));
+    pid_t *pids = calloc(n, sizeof(*pids));
+    char *passphrase = NULL;
+    unsigned long in_use = 0;
+    size_t next = 0, running = 0, encrypted = 0;
+
+    if(n && (!cost || !pids)) {
+        perror("calloc");
+        exit(E_INTERNAL);
+    }
+    if(!memory)
+        memory = luks_default_memory();
+
+    for(size_t i = 0; i < n; i++) {
+        struct luks_unlock *u = &devices[i];
+        struct stat st;
+        char *label;
+
+        u->error = 0;
+        if(!luks_is_encrypted(u->device)) {
+            u->status = DECRYPT_NOTENCRYPTED;
+            u->decrypted = strdup(u->device);
+            if(!u->decrypted) {
+                perror("strdup(device)");
+                exit(E_INTERNAL);
+            }
+            continue;
+        }
+        label = strreplace(u->device, '/', '_');
+        if(asprintf(&u->decrypted, "/dev/mapper/%s", label) == -1) {
+            perror("asprintf");
             exit(E_INTERNAL);
         }
-        luks_remove_lockfile(device);
-    } else
+        free(label);
+        if(!stat(u->decrypted, &st)) {
+            u->status = DECRYPT_EXISTS;
+            continue;
+        }
+        /* to be opened */
+        u->status = DECRYPT_FAILED;
+        pids[i] = -1;
+        cost[i] = luks_kdf_memory(u->device);
+        encrypted++;
+    }
+
+    if(encrypted && !password_file &&
+       !(passphrase = luks_read_passphrase())) {
+        fputs(_("Error: no passphrase given\n"), stderr);
+        encrypted = 0;
+    }
+
+    while(encrypted && (next < n || running)) {
+        pid_t pid = -1;
+        int status;
+
+        /* as many as the memory allows, and at least one */
+        for(; next < n; next++) {
+            struct luks_unlock *u = &devices[next];
+            char *label;
+
+            if(u->status != DECRYPT_FAILED)
+                continue;
+            if(running && in_use + cost[next] > memory)
+                break;
+            label = strreplace(u->device, '/', '_');
+            pids[next] = luks_start_open(u, label, password_file, passphrase,
+                                         readonly);
+            free(label);
+            if(pids[next] < 0)
+                continue;
+            in_use += cost[next];
+            running++;
+        }
+        if(!running)
+            break;
+
+        status = spawn_wait(&pid);
+        if(pid < 0)
+            break;
+        for(size_t i = 0; i < n; i++) {
+            struct luks_unlock *u = &devices[i];
+
+            if(pids[i] != pid || u->status != DECRYPT_FAILED)
+                continue;
+            pids[i] = 0;
+            in_use -= cost[i];
+            running--;
+            u->error = status;
+            if(status == 0) {
+                u->status = DECRYPT_OK;
+                /* We create a luks lockfile _on the decrypted device !_*/
+                if(!luks_create_lockfile(u->decrypted))
+                    fputs(_("Warning: could not create luks lockfile\n"),
+                          stderr);
+            }
+            break;
+        }
+    }
+
+    if(passphrase) {
+        explicit_bzero(passphrase, strlen(passphrase));
+        free(passphrase);
+    }
+    free(cost);
+    free(pids);
+}
+
+int
+luks_release(const char *device, int force)
+{
+    if(!force && !luks_has_lockfile(device)) {
         debug("Not luksClosing '%s' as there is no corresponding lockfile\n",
               device);
+        return 0;
+    }
+    switch(luks_close(device)) {
+    case -1:
+        fprintf(stderr, _("Error: could not close the LUKS mapping %s\n"),
+                device);
+        return -1;
+    case 1:
+        debug("%s is still in use, the kernel will remove it afterwards\n",
+              device);
+        break;
+    }
+    return 0;
+}
+
+int
+luks_close(const char *device)
+{
+    char sysfs[64];
+    struct stat st;
+
+    if(stat(device, &st) || !S_ISBLK(st.st_mode)) {
+        debug("%s is not mapped any more\n", device);
+        luks_remove_lockfile(device);
+        return 0;
+    }
+    /* Whatever still holds the mapping (udev probing it, a lazily
+       unmounted file system writing back) lets it go in its own time:
+       the kernel removes it then, cryptsetup neither waits nor fails */
+    if(spawnl(CRYPTSETUP_SPAWN_OPTIONS, CRYPTSETUPPROG, CRYPTSETUPPROG,
+              "close", "--deferred", device, (char *)NULL) != 0)
+        return -1;
+    luks_remove_lockfile(device);
+    snprintf(sysfs, sizeof(sysfs), "/sys/dev/block/%u:%u", major(st.st_rdev),
+             minor(st.st_rdev));
+    return access(sysfs, F_OK) ? 0 : 1;
 }
 
 int
@@ -217,7 +531,42 @@ luks_remove_lockfile(const char *device)
     if(rc < 0)
         saved_errno = errno;
     drop_root();
-    if(rc < 0)
+    /* closing a mapping pmount did not open finds no lockfile */
+    if(rc < 0 && saved_errno != ENOENT)
         fprintf(stderr, "unlink(%s): %s\n", path, strerror(saved_errno));
     free(path);
 }
+
+char **
+luks_lockfile_devices(void)
+{
+    /* lockfiles are named after /dev/mapper/<name>, and pmount names
+       have no slash: the name is what follows this prefix */
+    static const char prefix[] = "dev_mapper_";
+    char **devices = NULL;
+    size_t count = 0;
+    struct dirent *entry;
+    DIR *dir;
+
+    get_root();
+    dir = opendir(LUKS_LOCKDIR);
+    drop_root();
+    if(!dir)
+        return NULL;
+
+    while((entry = readdir(dir))) {
+        if(strncmp(entry->d_name, prefix, sizeof(prefix) - 1) ||
+           !entry->d_name[sizeof(prefix) - 1])
+            continue;
+        devices = realloc(devices, (count + 2) * sizeof(*devices));
+        if(!devices ||
+           asprintf(&devices[count], "/dev/mapper/%s",
+                    entry->d_name + sizeof(prefix) - 1) == -1) {
+            perror("luks_lockfile_devices");
+            exit(E_INTERNAL);
+        }
+        devices[++count] = NULL;
+    }
+    closedir(dir);
+    return devices;
+}
@@ -20,25 +20,66 @@ enum decrypt_status {
     DECRYPT_EXISTS
 };
 
+/**
+ * Check whether the given device carries LUKS metadata. This only reads the
+ * device.
+ * @return 1 if it does, 0 if it does not or cryptsetup is not installed
+ */
+int luks_is_encrypted(const char *device);
+
 /**
  * Check whether the given device is encrypted using dmcrypt with LUKS
  * metadata; if so, call cryptsetup to setup the device.
- * @param device raw device name
+ * @param device raw device name, which names the mapping
+ * @param node what cryptsetup opens to reach device, such as the
+ *        /proc/self/fd/ path of an opened device, or device itself
  * @param decrypted buffer for decrypted device; if device is unencrypted,
  *        this will be set to device
  * @param password_file file to read the password from (NULL means prompt)
  * @param readonly 1 if device is read-only
  */
-enum decrypt_status luks_decrypt(const char *device, char **decrypted,
-                                 const char *password_file, int readonly);
+enum decrypt_status luks_decrypt(const char *device, const char *node,
+                                 char **decrypted, const char *password_file,
+                                 int readonly);
+
+/**
+ * One device of luks_decrypt_many().
+ */
+struct luks_unlock {
+    const char *device;         /* set by the caller */
+    char *decrypted;            /* as for luks_decrypt(), to be freed */
+    enum decrypt_status status;
+    int error;                  /* the exit status of cryptsetup */
+};
+
+/**
+ * Same as luks_decrypt() for n devices at once: the passphrase is asked
+ * once (unless password_file is given) and the devices are opened in
+ * parallel, as long as the memory their key derivation takes stays
+ * within memory KiB (one is always opened). A lockfile is created on
+ * each mapping opened.
+ */
+void luks_decrypt_many(struct luks_unlock *devices, size_t n,
+                       const char *password_file, int readonly,
+                       unsigned long memory);
 
 /**
  * Check whether device is mapped through cryptsetup, and release it if
  * one of the given conditions are met:
  * - if force is true
  * - if the corresponding lockfile exists.
+ * @return 0 on success (or if there was nothing to release), -1 if the
+ * mapping could not be closed (the error is printed).
+ */
+int luks_release(const char *device, int force);
+
+/**
+ * Close the mapping device, deferring its removal until its last user
+ * lets it go if it is still in use, and remove its lockfile.
+ * @return 0 if it is gone, 1 if the kernel removes it later, -1 if
+ * cryptsetup failed, in which case the lockfile is kept.
  */
-void luks_release(const char *device, int force);
+int luks_close(const char *device);
 
 /**
  * Check whether the given real device has been mapped to a dmcrypt device. If
@@ -65,4 +106,13 @@ int luks_has_lockfile(const char *device);
  */
 void luks_remove_lockfile(const char *device);
 
+/**
+ * Lists the devices that have a luks 'lockfile', that is the mappings
+ * pmount opened and did not close (yet), whether they still exist or
+ * not.
+ * @return a NULL-terminated array of /dev/mapper/ paths, to be freed
+ * with the strings it contains, or NULL if there are none.
+ */
+char **luks_lockfile_devices(void);
+
 #endif /* !defined( __luks_h) */
@@ -0,0 +1,315 @@
+/**
+ * metrics.c -- cumulative counters and latency histograms
+ *
+ * This software is distributed under the terms and conditions of the
+ * GNU General Public License. See file GPL for the full text of the license.
+ */
+
+#define _GNU_SOURCE
+#include "config.h"
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libintl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "metrics.h"
+#include "utils.h"
+
+#define METRICS_FILE LOCKDIR "/.metrics"
+#define METRICS_MAGIC "PMSTATS"
+#define METRICS_VERSION 1
+
+#define METRICS_BUCKETS 14
+#define METRICS_COUNTERS 64
+
+static const struct {
+    const char *name;
+    const char *help;
+    double bounds[METRICS_BUCKETS]; /* ascending, 0-terminated */
+} metrics_hists[MH_NB] = {
+    [MH_MOUNT] = { "pmount_mount_duration_seconds",
+                   "Duration of pmount runs that mount a device.",
+                   { 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30,
+                     60 } },
+    [MH_UNMOUNT] = { "pmount_unmount_duration_seconds",
+                     "Duration of pumount runs.",
+                     { 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30,
+                       60 } },
+    [MH_LUKS] = { "pmount_luks_unlock_seconds",
+                  "Time spent unlocking LUKS devices, passphrase included.",
+                  { 0.1, 0.25, 0.5, 1, 2, 3, 5, 10, 30, 60 } },
+    [MH_FSCK] = { "pmount_fsck_seconds", "Time spent in fsck before mounting.",
+                  { 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60, 300 } },
+    [MH_DETECT] = { "pmount_mount_detection_attempts",
+                    "Mount attempts until the file system type was found.",
+                    { 1, 2, 3, 4, 6, 8, 12, 16 } },
+    [MH_FLUSH] = { "pmount_unmount_flush_seconds",
+                   "Time spent in umount, writing back dirty data.",
+                   { 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30,
+                     60 } },
+};
+
+/** One histogram of the state file */
+struct metrics_histogram {
+    uint64_t buckets[METRICS_BUCKETS]; /* not cumulative, the last is +Inf */
+    uint64_t count;
+    double sum;
+};
+
+/** One runs counter of the state file, by operation, exit status and type */
+struct metrics_counter {
+    uint32_t op;
+    int32_t code;
+    char fstype[16]; /* empty for an unused counter */
+    uint64_t count;
+};
+
+/** The state file, mapped in memory */
+struct metrics_state {
+    char magic[8];
+    uint32_t version;
+    uint32_t size;
+    struct metrics_counter counters[METRICS_COUNTERS];
+    struct metrics_histogram hists[MH_NB];
+};
+
+/* What this run adds to the state file */
+static struct metrics_histogram metrics_pending[MH_NB];
+static enum metrics_op metrics_op;
+static char metrics_fstype[16] = "unknown";
+static struct timespec metrics_start;
+/** The process the run is measured in: not the children it forks */
+static pid_t metrics_pid;
+
+static void
+metrics_add(struct metrics_histogram *h, enum metrics_hist which, double value)
+{
+    int i;
+
+    for(i = 0; i < METRICS_BUCKETS - 1 && metrics_hists[which].bounds[i]; i++)
+        if(value <= metrics_hists[which].bounds[i])
+            break;
+    if(!metrics_hists[which].bounds[i])
+        i = METRICS_BUCKETS - 1;
+    h->buckets[i]++;
+    h->count++;
+    h->sum += value;
+}
+
+void
+metrics_observe(enum metrics_hist h, double value)
+{
+    metrics_add(&metrics_pending[h], h, value);
+}
+
+double
+metrics_since(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+void
+metrics_set_fstype(const char *fstype)
+{
+    size_t i;
+
+    /* it ends up in a label value: keep it tame */
+    for(i = 0; fstype[i] && i < sizeof(metrics_fstype) - 1; i++)
+        metrics_fstype[i] = isalnum((unsigned char)fstype[i]) ||
+                                    strchr("._-", fstype[i])
+                                ? fstype[i]
+                                : '_';
+    metrics_fstype[i] = 0;
+}
+
+/**
+   Maps the state file, which is opened and locked as requested, and
+   initialized if it was not valid.
+
+   @return the mapping, or NULL (and *fd is -1) if there is none
+ */
+static struct metrics_state *
+metrics_map(int writable, int *fd)
+{
+    struct metrics_state *state;
+    struct stat st;
+
+    get_root();
+    if(writable && mkdir(LOCKDIR, 0755) && errno != EEXIST)
+        debug("metrics: could not create %s: %s\n", LOCKDIR, strerror(errno));
+    *fd = open(METRICS_FILE,
+               (writable ? O_RDWR | O_CREAT : O_RDONLY) | O_NOFOLLOW |
+                   O_CLOEXEC,
+               0644);
+    drop_root();
+    if(*fd < 0) {
+        debug("metrics: could not open %s: %s\n", METRICS_FILE,
+              strerror(errno));
+        return NULL;
+    }
+    if(flock(*fd, writable ? LOCK_EX : LOCK_SH) || fstat(*fd, &st))
+        goto error;
+
+    if(st.st_size != sizeof(*state)) {
+        if(!writable || ftruncate(*fd, 0) ||
+           ftruncate(*fd, sizeof(*state)))
+            goto error;
+    }
+    state = mmap(NULL, sizeof(*state),
+                 writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED,
+                 *fd, 0);
+    if(state == MAP_FAILED)
+        goto error;
+
+    if(memcmp(state->magic, METRICS_MAGIC, sizeof(state->magic)) ||
+       state->version != METRICS_VERSION || state->size != sizeof(*state)) {
+        if(!writable) {
+            munmap(state, sizeof(*state));
+            goto error;
+        }
+        memset(state, 0, sizeof(*state));
+        memcpy(state->magic, METRICS_MAGIC, sizeof(state->magic));
+        state->version = METRICS_VERSION;
+        state->size = sizeof(*state);
+    }
+    return state;
+
+error:
+    debug("metrics: %s is not usable: %s\n", METRICS_FILE, strerror(errno));
+    close(*fd);
+    *fd = -1;
+    return NULL;
+}
+
+static void
+metrics_commit(int status, void *arg)
+{
+    struct metrics_state *state;
+    struct metrics_counter *c, *free_counter = NULL;
+    int fd;
+
+    (void)arg;
+    if(getpid() != metrics_pid)
+        return;
+    metrics_observe(metrics_op == MO_MOUNT ? MH_MOUNT : MH_UNMOUNT,
+                    metrics_since(&metrics_start));
+
+    state = metrics_map(1, &fd);
+    if(!state)
+        return;
+
+    for(c = state->counters; c < state->counters + METRICS_COUNTERS; c++) {
+        if(!c->fstype[0]) {
+            if(!free_counter)
+                free_counter = c;
+        } else if(c->op == metrics_op && c->code == status &&
+                  !strcmp(c->fstype, metrics_fstype))
+            break;
+    }
+    if(c == state->counters + METRICS_COUNTERS) {
+        c = free_counter;
+        if(c) {
+            c->op = metrics_op;
+            c->code = status;
+            strcpy(c->fstype, metrics_fstype);
+        } else
+            debug("metrics: no counter left for %s\n", metrics_fstype);
+    }
+    if(c)
+        c->count++;
+
+    for(int h = 0; h < MH_NB; h++) {
+        for(int i = 0; i < METRICS_BUCKETS; i++)
+            state->hists[h].buckets[i] += metrics_pending[h].buckets[i];
+        state->hists[h].count += metrics_pending[h].count;
+        state->hists[h].sum += metrics_pending[h].sum;
+    }
+
+    munmap(state, sizeof(*state));
+    close(fd);
+}
+
+void
+metrics_init(enum metrics_op op)
+{
+    clock_gettime(CLOCK_MONOTONIC, &metrics_start);
+    metrics_op = op;
+    if(!metrics_pid)
+        on_exit(metrics_commit, NULL);
+    metrics_pid = getpid();
+}
+
+static void
+metrics_print_counters(FILE *out, const struct metrics_state *state,
+                       enum metrics_op op)
+{
+    const char *name =
+        op == MO_MOUNT ? "pmount_mounts_total" : "pmount_unmounts_total";
+
+    fprintf(out, "# HELP %s %s\n# TYPE %s counter\n", name,
+            op == MO_MOUNT ? "Mount runs by exit status and file system type."
+                           : "Unmount runs by exit status and file system "
+                             "type.",
+            name);
+    for(int i = 0; state && i < METRICS_COUNTERS; i++) {
+        const struct metrics_counter *c = &state->counters[i];
+
+        if(c->fstype[0] && c->op == op)
+            fprintf(out, "%s{fstype=\"%.15s\",code=\"%d\"} %llu\n", name,
+                    c->fstype, c->code, (unsigned long long)c->count);
+    }
+}
+
+int
+metrics_print(FILE *out)
+{
+    static const struct metrics_histogram empty;
+    struct metrics_state *state;
+    int fd;
+
+    state = metrics_map(0, &fd);
+
+    metrics_print_counters(out, state, MO_MOUNT);
+    metrics_print_counters(out, state, MO_UNMOUNT);
+
+    for(int h = 0; h < MH_NB; h++) {
+        const struct metrics_histogram *hist =
+            state ? &state->hists[h] : &empty;
+        const char *name = metrics_hists[h].name;
+        uint64_t cumulative = 0;
+
+        fprintf(out, "# HELP %s %s\n# TYPE %s histogram\n", name,
+                metrics_hists[h].help, name);
+        for(int i = 0; i < METRICS_BUCKETS - 1 && metrics_hists[h].bounds[i];
+            i++) {
+            cumulative += hist->buckets[i];
+            fprintf(out, "%s_bucket{le=\"%g\"} %llu\n", name,
+                    metrics_hists[h].bounds[i],
+                    (unsigned long long)cumulative);
+        }
+        fprintf(out, "%s_bucket{le=\"+Inf\"} %llu\n", name,
+                (unsigned long long)hist->count);
+        fprintf(out, "%s_sum %g\n%s_count %llu\n", name, hist->sum, name,
+                (unsigned long long)hist->count);
+    }
+
+    if(state) {
+        munmap(state, sizeof(*state));
+        close(fd);
+    }
+    if(fflush(out)) {
+        perror(_("Error: could not print the metrics"));
+        return -1;
+    }
+    return 0;
+}
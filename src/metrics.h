@@ -0,0 +1,57 @@
+/**
+ * @file metrics.h - cumulative counters and latency histograms
+ *
+ * This software is distributed under the terms and conditions of the
+ * GNU General Public License. See file GPL for the full text of the license.
+ */
+
+#ifndef __metrics_h
+#define __metrics_h
+
+#include <stdio.h>
+#include <time.h>
+
+/** The operation a run counts as */
+enum metrics_op {
+    MO_MOUNT,
+    MO_UNMOUNT,
+};
+
+/** The histograms */
+enum metrics_hist {
+    MH_MOUNT,   /* seconds from the start of a mount to its end */
+    MH_UNMOUNT, /* seconds from the start of an unmount to its end */
+    MH_LUKS,    /* seconds spent unlocking LUKS devices */
+    MH_FSCK,    /* seconds spent in fsck */
+    MH_DETECT,  /* mount attempts until the file system type was found */
+    MH_FLUSH,   /* seconds spent in umount, writing back dirty data */
+    MH_NB,
+};
+
+/**
+   Starts measuring a run as the operation op. When the program exits
+   (but not the children it forks, unless they call this again), the
+   run is counted by exit status and file system type, its
+   duration and the values observed in the meantime are added to the
+   histograms, in one update of the state file LOCKDIR/.metrics.
+ */
+void metrics_init(enum metrics_op op);
+
+/** Sets the file system type the run is counted for. */
+void metrics_set_fstype(const char *fstype);
+
+/** Adds value to the histogram h when the run is over. */
+void metrics_observe(enum metrics_hist h, double value);
+
+/** Returns the seconds elapsed since start (on CLOCK_MONOTONIC). */
+double metrics_since(const struct timespec *start);
+
+/**
+   Prints the metrics in the Prometheus text format, as read by the
+   textfile collector of node_exporter.
+
+   @return 0 on success, -1 on error (message is printed in this case)
+ */
+int metrics_print(FILE *out);
+
+#endif
@@ -0,0 +1,188 @@
+/**
+ * nls.c -- availability of the kernel NLS tables
+ *
+ * This software is distributed under the terms and conditions of the
+ * GNU General Public License. See file GPL for the full text of the license.
+ */
+
+#define _GNU_SOURCE
+#include "config.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+#include "nls.h"
+#include "utils.h"
+
+#define MODULES_DIR "/lib/modules"
+
+/* Charsets already checked during this run */
+static struct {
+    char name[32];
+    int available;
+} nls_checked[4];
+
+static int nls_nb_checked = 0;
+
+/**
+   Looks for the line "<charset> 1" in the cache file. Missing tables
+   are not cached, as modprobe or a package can bring them at any time
+   (lines "<charset> 0" of older caches are ignored).
+
+   @return 1 if the charset is cached as available, -1 otherwise.
+ */
+static int
+nls_cache_lookup(const char *cache, const char *charset)
+{
+    char line[64], name[33];
+    int available, rc = -1;
+    FILE *f;
+
+    get_root();
+    f = fopen(cache, "r");
+    drop_root();
+    if(!f)
+        return -1;
+    while(rc < 0 && fgets(line, sizeof(line), f))
+        if(sscanf(line, "%32s %d", name, &available) == 2 &&
+           !strcmp(name, charset) && available)
+            rc = 1;
+    fclose(f);
+    return rc;
+}
+
+static void
+nls_cache_store(const char *cache, const char *charset)
+{
+    char line[64];
+    int fd, len;
+
+    len = snprintf(line, sizeof(line), "%s 1\n", charset);
+    get_root();
+    fd = open(cache, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    drop_root();
+    if(fd < 0) {
+        debug("could not open the NLS cache %s\n", cache);
+        return;
+    }
+    if(write(fd, line, len) != len)
+        debug("could not write to the NLS cache %s\n", cache);
+    close(fd);
+}
+
+/**
+   Checks the running kernel for the nls_<charset> module.
+
+   @return 1 if it is there, 0 if not, -1 if that cannot be told.
+ */
+static int
+nls_probe(const char *release, const char *charset)
+{
+    char *path, *module, line[256];
+    size_t len;
+    struct dirent *ent;
+    DIR *dir;
+    FILE *f;
+    int found = 0;
+
+    /* loaded (or built in with parameters): /sys/module has '_' for '-' */
+    module = strreplace(charset, '-', '_');
+    if(asprintf(&path, "/sys/module/nls_%s", module) == -1) {
+        free(module);
+        return -1;
+    }
+    free(module);
+    found = !access(path, F_OK);
+    free(path);
+    if(found)
+        return 1;
+
+    if(asprintf(&module, "nls_%s.ko", charset) == -1)
+        return -1;
+    len = strlen(module);
+
+    /* built in */
+    if(asprintf(&path, MODULES_DIR "/%s/modules.builtin", release) == -1) {
+        free(module);
+        return -1;
+    }
+    f = fopen(path, "r");
+    free(path);
+    if(!f) {
+        /* no way to know what is built in */
+        free(module);
+        return -1;
+    }
+    while(!found && fgets(line, sizeof(line), f)) {
+        char *base = strrchr(line, '/');
+        found = base && !strncmp(base + 1, module, len);
+    }
+    fclose(f);
+
+    /* available for loading, possibly compressed */
+    if(!found &&
+       asprintf(&path, MODULES_DIR "/%s/kernel/fs/nls", release) != -1) {
+        dir = opendir(path);
+        free(path);
+        while(dir && !found && (ent = readdir(dir)))
+            found = !strncmp(ent->d_name, module, len) &&
+                    (ent->d_name[len] == 0 || ent->d_name[len] == '.');
+        if(dir)
+            closedir(dir);
+    }
+
+    free(module);
+    return found;
+}
+
+int
+nls_available(const char *charset, int update_cache)
+{
+    struct utsname uts;
+    char *cache = NULL;
+    int available;
+
+    for(int i = 0; i < nls_nb_checked; i++)
+        if(!strcmp(nls_checked[i].name, charset))
+            return nls_checked[i].available;
+
+    /* the charset ends up in file names */
+    if(!is_word_str(charset) || strlen(charset) >= sizeof(nls_checked[0].name))
+        return 1;
+
+    if(uname(&uts)) {
+        perror("uname");
+        return 1;
+    }
+
+    if(asprintf(&cache, LOCKDIR "/.nls-%s", uts.release) != -1)
+        available = nls_cache_lookup(cache, charset);
+    else {
+        cache = NULL;
+        available = -1;
+    }
+
+    if(available < 0) {
+        available = nls_probe(uts.release, charset);
+        debug("NLS table for %s: %s\n", charset,
+              available > 0    ? "available"
+              : available == 0 ? "missing"
+                               : "unknown");
+        if(available < 0)
+            available = 1;
+        else if(available && cache && update_cache)
+            nls_cache_store(cache, charset);
+    } else
+        debug("NLS table for %s: available (cached)\n", charset);
+    free(cache);
+
+    if(nls_nb_checked < (int)(sizeof(nls_checked) / sizeof(nls_checked[0]))) {
+        strcpy(nls_checked[nls_nb_checked].name, charset);
+        nls_checked[nls_nb_checked++].available = available;
+    }
+    return available;
+}
@@ -0,0 +1,26 @@
+/**
+ * @file nls.h - availability of the kernel NLS tables
+ *
+ * This software is distributed under the terms and conditions of the
+ * GNU General Public License. See file GPL for the full text of the license.
+ */
+
+#ifndef __nls_h
+#define __nls_h
+
+/**
+   Checks whether the kernel has the NLS table needed by the
+   iocharset= (or nls=) option for the given charset: the nls_*
+   module is loaded, built in, or available for loading.
+
+   The answer is remembered for the rest of the run. A charset that is
+   available is also cached in LOCKDIR for the running kernel release,
+   unless update_cache is false; a missing one is checked again on
+   every run, as its module may be installed meanwhile.
+
+   @return 1 if the charset is available or if that cannot be told
+   (no modules directory), 0 if it is missing.
+ */
+int nls_available(const char *charset, int update_cache);
+
+#endif
@@ -0,0 +1,181 @@
+/**
+ * overlay.c -- writable tmpfs overlays on top of read-only mounts
+ *
+ * This software is distributed under the terms and conditions of the
+ * GNU General Public License. See file GPL for the full text of the license.
+ */
+
+#define _GNU_SOURCE
+#include "config.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <libintl.h>
+#include <mntent.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if HAVE_FSOPEN
+#include <sys/mount.h>
+#endif
+
+#include "overlay.h"
+#include "utils.h"
+
+int
+overlay_mounted(const char *mntpt)
+{
+    struct mntent entry;
+    char buf[4096];
+    int overlay = 0;
+    FILE *f;
+
+    if(!(f = setmntent("/proc/self/mounts", "r")))
+        return 0;
+    /* later entries are mounted on top of earlier ones */
+    while(getmntent_r(f, &entry, buf, sizeof(buf)))
+        if(!strcmp(entry.mnt_dir, mntpt))
+            overlay = !strcmp(entry.mnt_type, "overlay");
+    endmntent(f);
+    return overlay;
+}
+
+#if HAVE_FSOPEN
+
+/**
+   Prints what the kernel logged about the failure of the file system
+   context fs_fd, or the error of the last call if it logged nothing.
+ */
+static void
+overlay_report(int fs_fd, const char *what)
+{
+    char message[512];
+    int saved_errno = errno, logged = 0;
+    ssize_t len;
+
+    /* each read() returns one "e overlayfs: ..." line */
+    while((len = read(fs_fd, message, sizeof(message) - 1)) > 0) {
+        message[len] = 0;
+        if(message[0] == 'e' && message[1] == ' ') {
+            fprintf(stderr, _("Error: %s: %s\n"), what, message + 2);
+            logged = 1;
+        } else
+            debug("%s: %s\n", what, message);
+    }
+    if(!logged)
+        fprintf(stderr, _("Error: %s: %s\n"), what, strerror(saved_errno));
+}
+
+int
+overlay_mount(const char *device, const char *mntpt, unsigned size_mib,
+              int exec)
+{
+    char tmpfs_opts[64], lower[64], upper[64], work[64];
+    struct stat st;
+    int lower_fd, tmpfs_fd = -1, fs_fd = -1, tree_fd = -1, rc = -1;
+
+    get_root();
+    /* the file system below, before the tmpfs hides it */
+    lower_fd = open(mntpt, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if(lower_fd < 0 || fstat(lower_fd, &st)) {
+        fprintf(stderr, "%s: %s\n", mntpt, strerror(errno));
+        goto lower_fd;
+    }
+
+    /* The tmpfs only needs a mount point until the overlay holds it, but
+       overlayfs wants its upper layer in our mount namespace: it goes on
+       mntpt for that time */
+    if(size_mib)
+        snprintf(tmpfs_opts, sizeof(tmpfs_opts), "mode=0700,size=%um",
+                 size_mib);
+    else
+        snprintf(tmpfs_opts, sizeof(tmpfs_opts), "mode=0700");
+    debug("mounting a tmpfs (%s) for the overlay of %s\n", tmpfs_opts,
+          mntpt);
+    if(mount("tmpfs", mntpt, "tmpfs", MS_NOSUID | MS_NODEV | MS_NOEXEC,
+             tmpfs_opts)) {
+        perror(_("Error: could not mount the tmpfs of the overlay"));
+        goto lower_fd;
+    }
+
+    /* the root of the overlay looks like its upper directory */
+    tmpfs_fd = open(mntpt, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if(tmpfs_fd < 0 || mkdirat(tmpfs_fd, "upper", 0700) ||
+       fchownat(tmpfs_fd, "upper", st.st_uid, st.st_gid, 0) ||
+       fchmodat(tmpfs_fd, "upper", st.st_mode & 07777, 0) ||
+       mkdirat(tmpfs_fd, "work", 0700)) {
+        perror(_("Error: could not prepare the tmpfs of the overlay"));
+        goto tmpfs;
+    }
+
+    snprintf(lower, sizeof(lower), "/proc/self/fd/%d", lower_fd);
+    snprintf(upper, sizeof(upper), "/proc/self/fd/%d/upper", tmpfs_fd);
+    snprintf(work, sizeof(work), "/proc/self/fd/%d/work", tmpfs_fd);
+    debug("mounting an overlay of %s, lowerdir=%s,upperdir=%s,workdir=%s\n",
+          device, lower, upper, work);
+
+    fs_fd = fsopen("overlay", FSOPEN_CLOEXEC);
+    if(fs_fd < 0) {
+        perror("fsopen(overlay)");
+        goto tmpfs;
+    }
+    if(fsconfig(fs_fd, FSCONFIG_SET_STRING, "source", device, 0) ||
+       fsconfig(fs_fd, FSCONFIG_SET_STRING, "lowerdir", lower, 0) ||
+       fsconfig(fs_fd, FSCONFIG_SET_STRING, "upperdir", upper, 0) ||
+       fsconfig(fs_fd, FSCONFIG_SET_STRING, "workdir", work, 0) ||
+       fsconfig(fs_fd, FSCONFIG_CMD_CREATE, NULL, NULL, 0)) {
+        overlay_report(fs_fd, _("could not set up the overlay"));
+        goto tmpfs;
+    }
+    tree_fd = fsmount(fs_fd, FSMOUNT_CLOEXEC,
+                      MOUNT_ATTR_NOSUID | MOUNT_ATTR_NODEV |
+                          (exec ? 0 : MOUNT_ATTR_NOEXEC));
+    if(tree_fd < 0)
+        overlay_report(fs_fd, _("could not mount the overlay"));
+
+tmpfs:
+    /* the overlay keeps its own reference to the tmpfs */
+    if(umount2(mntpt, MNT_DETACH)) {
+        perror(_("Error: could not unmount the tmpfs of the overlay"));
+        rc = -2;
+        goto fds;
+    }
+    if(tree_fd < 0)
+        goto fds;
+    if(move_mount(tree_fd, "", AT_FDCWD, mntpt, MOVE_MOUNT_F_EMPTY_PATH)) {
+        perror("move_mount");
+        goto fds;
+    }
+    rc = 0;
+
+fds:
+    if(tree_fd >= 0)
+        close(tree_fd);
+    if(fs_fd >= 0)
+        close(fs_fd);
+    if(tmpfs_fd >= 0)
+        close(tmpfs_fd);
+lower_fd:
+    if(lower_fd >= 0)
+        close(lower_fd);
+    drop_root();
+    return rc;
+}
+
+#else /* !HAVE_FSOPEN */
+
+int
+overlay_mount(const char *device, const char *mntpt, unsigned size_mib,
+              int exec)
+{
+    (void)device;
+    (void)mntpt;
+    (void)size_mib;
+    (void)exec;
+    fputs(_("Error: pmount was built without support for overlays\n"),
+          stderr);
+    return -1;
+}
+
+#endif /* HAVE_FSOPEN */
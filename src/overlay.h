@@ -0,0 +1,36 @@
+/**
+ * @file overlay.h - writable tmpfs overlays on top of read-only mounts
+ *
+ * This software is distributed under the terms and conditions of the
+ * GNU General Public License. See file GPL for the full text of the license.
+ */
+
+#ifndef __overlay_h
+#define __overlay_h
+
+/**
+   Stacks an overlayfs on top of the (read-only) file system mounted at
+   mntpt, whose changes go to a tmpfs of at most size_mib MiB (or the
+   tmpfs default, half of the memory, if 0). The tmpfs has no mount
+   point of its own: it goes away with the overlay, which only needs to
+   be unmounted before the file system below it. The overlay is shown
+   as device in the mount table, and is mounted nosuid, nodev and,
+   unless exec is true, noexec.
+
+   This requires the new mount API (Linux 5.2) and a lower file system
+   that overlayfs accepts, which excludes the case-insensitive ones
+   (vfat, exfat...).
+
+   Returns 0 on success, and -1 on errors (which are printed), in which
+   case the file system mounted at mntpt is left as it was, or -2 if the
+   tmpfs could not be taken off it either: it is still mounted on top.
+ */
+int overlay_mount(const char *device, const char *mntpt, unsigned size_mib,
+                  int exec);
+
+/**
+   Returns whether the topmost mount at mntpt is an overlayfs.
+ */
+int overlay_mounted(const char *mntpt);
+
+#endif
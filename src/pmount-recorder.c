@@ -0,0 +1,52 @@
+/**
+ * pmount-recorder.c - prints the flight recorder dumps of pmount and
+ *                     pumount
+ *
+ * This software is distributed under the terms and conditions of the
+ * GNU General Public License. See file GPL for the full text of the license.
+ */
+
+#define _GNU_SOURCE
+#include "config.h"
+#include <libintl.h>
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "recorder.h"
+#include "utils.h"
+
+int
+main(int argc, char *const argv[])
+{
+    int rc = EXIT_SUCCESS;
+
+    /* for the dates, messages set up their own part of the locale */
+    setlocale(LC_ALL, "");
+
+    if(argc < 2 || !strcmp(argv[1], "-h") || !strcmp(argv[1], "--help")) {
+        printf(_("Usage: %s <dump>...\n"
+                 "  Print the events recorded by a pmount or pumount run "
+                 "that failed,\n"
+                 "  as found in %s/.recorder/\n"),
+               argv[0], LOCKDIR);
+        return argc < 2 ? E_ARGS : EXIT_SUCCESS;
+    }
+
+    for(int i = 1; i < argc; i++) {
+        FILE *f = fopen(argv[i], "r");
+
+        if(!f) {
+            perror(argv[i]);
+            rc = E_ARGS;
+            continue;
+        }
+        if(argc > 2)
+            printf("%s%s:\n", i > 1 ? "\n" : "", argv[i]);
+        if(recorder_decode(f, stdout))
+            rc = EXIT_FAILURE;
+        fclose(f);
+    }
+    return rc;
+}
@@ -19,17 +19,31 @@
 #include <libintl.h>
 #include <limits.h>
 #include <locale.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "admission.h"
+#include "device.h"
 #include "fs.h"
+#include "helper.h"
+#include "ident.h"
+#include "idmap.h"
+#include "iostat.h"
 #include "loop.h"
 #include "luks.h"
+#include "metrics.h"
+#include "nls.h"
+#include "overlay.h"
 #include "policy.h"
+#include "probe.h"
+#include "recorder.h"
 #include "utils.h"
 /* Configuration file handling */
 #include "configuration.h"
@@ -70,6 +84,18 @@ usage(const char *exename)
     printf(_("%s --unlock <device> <pid>\n"
              "  Remove the lock on <device> for process <pid> again.\n\n"),
            exename);
+
+    printf(_("%s --multiple <device>...\n"
+             "  Mount each <device> on its default mount point, opening the "
+             "encrypted ones\n"
+             "  together with a single passphrase.\n\n"),
+           exename);
+
+    printf(_("%s --probe [<device>...]\n"
+             "  Print the type of the given devices, or of all the removable "
+             "ones, reading\n"
+             "  them all at once.\n\n"),
+           exename);
     puts(_(
         "Options:\n"
         "  -r          : force <device> to be mounted read-only\n"
@@ -99,13 +125,26 @@ usage(const char *exename)
         "system_u:object_r:removable_t:s0\n"
         "  -d, --debug : enable debug output (very verbose)\n"
         "  -F, --fsck  : runs fsck on the device before mounting\n"
+        "  --idmap     : make the owner of a POSIX file system (ext4, btrfs...)\n"
+        "                appear as yourself, using an ID-mapped mount\n"
+        "  --overlay   : mount <device> read-only, with a tmpfs on top of it\n"
+        "                to which the changes go, and which they do not\n"
+        "                outlive\n"
+        "  --explain   : print the resolved device, the policy verdicts, the\n"
+        "                detected types, the mount options and the helper\n"
+        "                commands, with the time spent in each step, and exit\n"
+        "                without mounting anything\n"
+        "  --metrics   : print the mount and unmount counters and latencies\n"
+        "                in the Prometheus text format and exit\n"
+        "  --idempotent: if <device> is already mounted by you with the same\n"
+        "                options, print its mount point and exit successfully\n"
         "  -h, --help  : print this help message and exit successfully\n"
         "  -V, --version\n"
         "                print version number and exit successfully"));
 }
 
 static struct {
-    enum { MOUNT, LOCK, UNLOCK } mode;
+    enum { MOUNT, LOCK, UNLOCK, PROBE, MULTIPLE } mode;
     char *iocharset;
     char *umask, *fmask, *dmask;
     char *passphrase;
@@ -113,6 +152,11 @@ static struct {
     bool exec;
     bool noatime;
     bool run_fsck; /* Whether or not to run fsck before mounting. */
+    bool idmap;    /* Whether to ID-map file systems without uid= option */
+    bool overlay;  /* Whether to make a read-only mount writable in memory */
+    bool explain;  /* Whether to only print what would be done */
+    bool unlocked; /* Whether --multiple already opened the LUKS mapping */
+    bool idempotent; /* Whether an existing mount of the device will do */
     bool async;
     bool use_selinux_context;
     /* Whether the timestamps are stored in UTC rather than local time */
@@ -129,24 +173,71 @@ static struct {
     .exec = false,
     .noatime = false,
     .run_fsck = false,
+    .idmap = false,
+    .overlay = false,
+    .explain = false,
+    .unlocked = false,
+    .idempotent = false,
     .async = true,
     .use_selinux_context = false,
     .utc = false,
     .force_write = FW_DEFAULT,
 };
 
+/**
+ * The file system that was successfully mounted by do_mount(), if any.
+ */
+static const struct FS *mounted_fs = NULL;
+
+/**
+ * Start of the current --explain phase.
+ */
+static struct timespec explain_clock;
+
+/**
+ * Print a line of the --explain plan, for the given phase.
+ */
+static void __attribute__((format(printf, 2, 3)))
+explain(const char *phase, const char *format, ...)
+{
+    va_list ap;
+
+    printf("%-8s ", phase);
+    va_start(ap, format);
+    vprintf(format, ap);
+    va_end(ap);
+    putchar('\n');
+}
+
+/**
+ * Print the time spent in the given --explain phase, and start the next one.
+ */
+static void
+explain_time(const char *phase)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    explain(phase, _("done in %.3f ms"),
+            (now.tv_sec - explain_clock.tv_sec) * 1e3 +
+                (now.tv_nsec - explain_clock.tv_nsec) / 1e6);
+    explain_clock = now;
+}
+
 /**
  * Check whether the user is allowed to mount the given device to the given
- * mount point. Creates the mount point if it does not exist yet.
+ * mount point. Creates the mount point if it does not exist yet. That dev
+ * is a block device was checked when it was opened.
  * @return 0 on success, -1 on failure
  */
 static int
-check_mount_policy(const char *device, const char *mntpt, int doing_loop)
+check_mount_policy(const struct device_handle *dev, const char *mntpt,
+                   int doing_loop)
 {
-    int result = device_valid(device) && !device_mounted(device, 0, NULL) &&
-                 (doing_loop || device_allowlisted(device) ||
-                  device_removable(device)) &&
-                 !device_locked(device) && mntpt_valid(mntpt) &&
+    int result = !device_mounted(dev->path, 0, NULL) &&
+                 (doing_loop || device_allowlisted(dev->path) ||
+                  device_handle_removable(dev)) &&
+                 !device_locked(dev->path) && mntpt_valid(mntpt) &&
                  !mntpt_mounted(mntpt, 0);
 
     if(result)
@@ -159,6 +250,32 @@ check_mount_policy(const char *device, const char *mntpt, int doing_loop)
     return result ? 0 : -1;
 }
 
+/**
+ * Number of bytes at the beginning of a device that LUKS and file system
+ * detection read: this covers the LUKS2 header and the superblocks of all
+ * supported file systems (the btrfs one lives at 64 KiB).
+ */
+#define PROBE_HEADER_SIZE (128 * 1024)
+
+/**
+ * Ask the kernel to start reading the device headers that detection will
+ * need, so that the I/O is in flight while the policy is checked. The page
+ * cache of a block device is dropped on its last close, so dev must be kept
+ * open until detection is done.
+ * @param dev opened device to prefetch
+ */
+static void
+prefetch_device_headers(const struct device_handle *dev)
+{
+    int rc = posix_fadvise(dev->fd, 0, PROBE_HEADER_SIZE, POSIX_FADV_WILLNEED);
+
+    if(rc)
+        debug("posix_fadvise(%s): %s\n", dev->path, strerror(rc));
+    else
+        debug("prefetching the first %u KiB of %s\n",
+              PROBE_HEADER_SIZE / 1024, dev->path);
+}
+
 /**
  * Create a mount point pathname.
  * @param device device for which a moint point is created
@@ -218,13 +335,123 @@ make_mountpoint_name(const char *device, const char *label)
     return mntpt;
 }
 
+/**
+ * Find the loop device image is attached to.
+ * @return the loop device (to be freed), or NULL if there is none
+ */
+static char *
+image_loop_device(const char *image)
+{
+    char path[PATH_MAX], backing[PATH_MAX], *device = NULL;
+    struct dirent *entry;
+    DIR *dir;
+    FILE *f;
+
+    if(!(dir = opendir("/sys/block")))
+        return NULL;
+    while(!device && (entry = readdir(dir))) {
+        if(strncmp(entry->d_name, "loop", 4))
+            continue;
+        snprintf(path, sizeof(path), "/sys/block/%s/loop/backing_file",
+                 entry->d_name);
+        if(!(f = fopen(path, "r")))
+            continue;
+        if(fgets(backing, sizeof(backing), f)) {
+            backing[strcspn(backing, "\n")] = 0;
+            if(!strcmp(backing, image) &&
+               asprintf(&device, DEVDIR "%s", entry->d_name) == -1) {
+                perror("asprintf");
+                exit(E_INTERNAL);
+            }
+        }
+        fclose(f);
+    }
+    closedir(dir);
+    return device;
+}
+
+/**
+ * For --idempotent: check whether device (or its LUKS mapping) is already
+ * mounted below MEDIADIR by pmount for the user (as recorded by
+ * mount_owner_record()), on the mount point that was asked for if label is
+ * given, and with the options of this run. If so, print the mount point.
+ * Mounts whose owner cannot be told are not ours.
+ * @param device device node, or image file if is_image
+ * @return 1 if the existing mount will do, 0 if device is not mounted that
+ *         way, -1 if it is, but with other options (error is printed)
+ */
+static int
+already_mounted(const char *device, int is_image, const char *label)
+{
+    const struct mntent *entry;
+    char *mapped = NULL, *loop = NULL, *mediadir, *mntpt;
+    char *wanted = NULL;
+    int rc = 0;
+
+    if(is_image && !(device = loop = image_loop_device(device)))
+        return 0;
+    if(luks_get_mapped_device(device, &mapped))
+        device = mapped;
+    entry = fstab_find_device("/proc/mounts", device);
+    if(!entry || !(mediadir = realpath(MEDIADIR, NULL)))
+        goto out;
+
+    /* the mount pmount would have made */
+    if(strncmp(entry->mnt_dir, mediadir, strlen(mediadir)) ||
+       entry->mnt_dir[strlen(mediadir)] != '/' ||
+       !mount_owner_check(MOUNT_OWNER_DIR, entry->mnt_dir, getuid())) {
+        debug("%s is mounted on %s, but not by pmount for you\n", device,
+              entry->mnt_dir);
+        free(mediadir);
+        goto out;
+    }
+    free(mediadir);
+    if(label && (mntpt = make_mountpoint_name(device, label))) {
+        /* MEDIADIR may be a symlink, as above */
+        wanted = realpath(mntpt, NULL);
+        free(mntpt);
+    }
+
+    /* and with what was asked for */
+    if((label && (!wanted || strcmp(wanted, entry->mnt_dir))) ||
+       (options.force_write == FW_RO && !hasmntopt(entry, "ro")) ||
+       (options.force_write == FW_RW && hasmntopt(entry, "ro")) ||
+       !options.async != !!hasmntopt(entry, "sync") ||
+       (options.noatime && !hasmntopt(entry, "noatime")) ||
+       (options.exec && hasmntopt(entry, "noexec")) ||
+       options.overlay != overlay_mounted(entry->mnt_dir) ||
+       (options.use_fstype && strncmp(entry->mnt_type, "fuse", 4) &&
+        strcmp(options.use_fstype, entry->mnt_type))) {
+        fprintf(stderr,
+                _("Error: device %s is already mounted to %s with other "
+                  "options\n"),
+                device, entry->mnt_dir);
+        rc = -1;
+        goto out;
+    }
+    debug("%s is already mounted on %s as asked\n", device, entry->mnt_dir);
+    puts(entry->mnt_dir);
+    rc = 1;
+out:
+    free(wanted);
+    free(mapped);
+    free(loop);
+    return rc;
+}
+
 /**
  * Drop all privileges and exec 'mount device'. Does not return on success, if
- * it returns, MOUNTPROG could not be executed.
+ * it returns, MOUNTPROG could not be executed (or --explain was given).
  */
 static void
 do_mount_fstab(const char *device)
 {
+    if(options.explain) {
+        explain("resolve", _("%s is handled by /etc/fstab, would run: %s %s"),
+                device, MOUNTPROG, device);
+        return;
+    }
+
     debug("device %s handled by fstab, calling mount\n", device);
 
     /* drop all privileges and transparently call mount */
@@ -237,69 +464,40 @@ do_mount_fstab(const char *device)
 }
 
 /**
- * Raise to full privileges and call mount with given file system. Exits the
- * program immediately if MOUNTPROG cannot be executed or the given file system
- * is invalid. NOTE: This function must not exit() since it is called in a
- * lock-unlock-block.
- * @param device device node to mount
- * @param mntpt desired mount point
+ * Assemble the mount options for the given file system from the command line
+ * options, with fs_mount_options().
  * @param fsname file system name (mount option -t)
  * @param utf8 is true if the option utf8 should be used for VFAT
- * @param suppress_errors: if true, stderr is redirected to /dev/null
- * @return exit status of mount, or -1 on failure.
+ * @param mount_opts buffer for the option string
+ * @param size size of mount_opts
+ * @return the file system information, or NULL if fsname or the options are
+ *         invalid (message is printed in this case)
  */
-static int
-do_mount(const char *device, const char *mntpt, const char *fsname, int utf8,
-         int suppress_errors)
+static const struct FS *
+build_mount_options(const char *fsname, int utf8, char *mount_opts,
+                    size_t size)
 {
-    const struct FS *fs;
-    char ugid_opt[100];
-    char umask_opt[100];
-    char fdmask_opt[100];
-    char iocharset_opt[100];
-    const char *utc_opt = "";
-    const char *sync_opt = ",sync";
-    const char *atime_opt = ",atime";
-    const char *exec_opt = ",noexec";
-    const char *access_opt = NULL;
-    const char *selinux_context_opt = "";
-    char mount_opts[1000];
-
-    /* check and retrieve option information for requested file system */
-    if(!fsname) {
-        fputs(_("Internal error: mount_attempt: given file system name is "
-                "NULL\n"),
-              stderr);
-        return -1;
-    }
-
-    fs = get_fs_info(fsname);
-    if(!fs) {
-        fprintf(stderr, _("Error: invalid file system name '%s'\n"), fsname);
-        return -1;
-    }
-
-    /* validate user specified masks */
-    if(options.umask && parse_unsigned(options.umask, E_ARGS) > 0777) {
-        fprintf(stderr, _("Error: invalid umask %s\n"), options.umask);
-        return -1;
-    }
-
-    if(options.fmask && parse_unsigned(options.fmask, E_ARGS) > 0777) {
-        fprintf(stderr, _("Error: invalid fmask %s\n"), options.fmask);
-        return -1;
-    }
-
-    if(options.dmask && parse_unsigned(options.dmask, E_ARGS) > 0777) {
-        fprintf(stderr, _("Error: invalid dmask %s\n"), options.dmask);
-        return -1;
-    }
+    const struct FS *fs = fsname ? get_fs_info(fsname) : NULL;
+    struct mount_request request = {
+        .iocharset = options.iocharset,
+        .umask = options.umask,
+        .fmask = options.fmask,
+        .dmask = options.dmask,
+        .async = options.async,
+        .noatime = options.noatime,
+        .exec = options.exec,
+        .access = options.force_write == FW_RO   ? FS_ACCESS_RO
+                  : options.force_write == FW_RW ? FS_ACCESS_RW
+                                                 : FS_ACCESS_DEFAULT,
+        .selinux_context = options.use_selinux_context,
+        .utc = options.utc,
+        .utf8 = utf8,
+        .uid = getuid(),
+        .gid = getgid(),
+    };
 
-    /* assemble option string */
-    *ugid_opt = *umask_opt = *fdmask_opt = *iocharset_opt = 0;
-    if(fs->support_ugid) {
+    if(fs && fs->support_ugid) {
         struct stat statbuf;
-        gid_t gid = getgid();
         int result;
 
         /* if pmount is installed setgid, use that group, otherwise use the
@@ -311,173 +509,543 @@ do_mount(const char *device, const char *mntpt, const char *fsname, int utf8,
             fprintf(stderr, "Can't stat myself\n");
         else {
             if(statbuf.st_mode & S_ISGID)
-                gid = statbuf.st_gid;
+                request.gid = statbuf.st_gid;
         }
-        snprintf(ugid_opt, sizeof(ugid_opt), ",uid=%u,gid=%u", getuid(), gid);
     }
+    /* only vfat falls back to it, and asking may load a module */
+    if(fs && !strcmp(fs->fsname, "vfat"))
+        request.iso8859_1 = nls_available("iso8859-1", !options.explain);
 
-    if(fs->umask)
-        snprintf(umask_opt, sizeof(umask_opt), ",umask=%s",
-                 options.umask ? options.umask : fs->umask);
-    /* If the fs supports fdmasks, we try to make some values
-       up.
-    */
-    if(fs->umask && fs->fdmask) {
-        /* We deal with masks in another way now: */
-        unsigned i_umask, i_dmask, i_fmask;
-
-        /* We first get the umask value */
-        if(options.umask)
-            i_umask =
-                parse_unsigned(options.umask, E_ARGS); /* shouldn't fail */
-        else
-            i_umask = parse_unsigned(fs->umask, E_ARGS); /* shouldn't fail */
-
-        /* Now the fmask */
-        if(options.fmask)
-            i_fmask =
-                parse_unsigned(options.fmask, E_ARGS); /* shouldn't fail */
-        else                          /* make up from the umask parameter */
-            i_fmask = i_umask | 0111; /* remove exec permissions */
-        /* And the dmask */
-        if(options.dmask)
-            i_dmask =
-                parse_unsigned(options.dmask, E_ARGS); /* shouldn't fail */
-        else                   /* make up from the umask parameter */
-            i_dmask = i_umask; /* same as umask */
-        snprintf(fdmask_opt, sizeof(fdmask_opt), fs->fdmask, i_fmask, i_dmask);
-    }
+    return fs_mount_options(fsname, &request, mount_opts, size);
+}
 
-    if(options.async)
-        sync_opt = ",async";
+/**
+ * Why the last do_mount() failed, as told by the error output of mount.
+ */
+static enum mount_failure {
+    MF_NONE,       /* it did not */
+    MF_FS_TYPE,    /* wrong file system type (or no way to tell) */
+    MF_BAD_OPTION, /* an option was refused, see failed_option */
+    MF_NO_MEDIUM,
+    MF_BUSY,
+    MF_PERMISSION,
+    MF_OTHER,
+} mount_failure = MF_NONE;
 
-    if(options.noatime)
-        atime_opt = ",noatime";
+/**
+ * The option refused by the file system, if mount said which one.
+ */
+static char failed_option[64];
 
-    if(options.exec)
-        exec_opt = ",exec";
+/**
+ * Options that are never dropped when retrying, as they protect the system.
+ */
+static const char *const kept_options[] = {
+    "nosuid", "nodev", "noexec", "ro", "context", NULL,
+};
 
-    if(options.force_write == FW_RO)
-        access_opt = ",ro";
-    else if(options.force_write == FW_RW)
-        access_opt = ",rw";
-    else
-        access_opt = "";
+/**
+ * Find the option named in the error message of mount, after one of the
+ * markers.
+ */
+static void
+find_failed_option(const char *errors)
+{
+    static const char *const markers[] = {
+        "nknown parameter '",
+        "nrecognized mount option \"",
+        "ad value for '",
+        NULL,
+    };
+    const char *start;
+    size_t len;
 
-    if(options.use_selinux_context)
-        selinux_context_opt = ",context=system_u:object_r:removable_t:s0";
+    *failed_option = 0;
+    for(int i = 0; markers[i]; i++) {
+        start = strstr(errors, markers[i]);
+        if(!start)
+            continue;
+        start += strlen(markers[i]);
+        len = strcspn(start, "'\"=");
+        if(len > 0 && len < sizeof(failed_option) && start[len] != 0) {
+            memcpy(failed_option, start, len);
+            failed_option[len] = 0;
+        }
+        return;
+    }
+}
 
-    if(!strcmp(fsname, "vfat") && options.utc)
-        utc_opt = ",tz=UTC";
+/**
+ * Classify a failure of mount from its exit status and error output.
+ */
+static enum mount_failure
+classify_mount_failure(int status, const char *errors)
+{
+    /* more specific messages first: the legacy "wrong fs type, bad
+       option, bad superblock" one covers all EINVAL failures */
+    static const struct {
+        const char *pattern;
+        enum mount_failure failure;
+    } patterns[] = {
+        { "nknown parameter", MF_BAD_OPTION },
+        { "nrecognized mount option", MF_BAD_OPTION },
+        { "ad value for", MF_BAD_OPTION },
+        { "no medium found", MF_NO_MEDIUM },
+        { "busy", MF_BUSY },
+        { "already mounted", MF_BUSY },
+        { "ermission denied", MF_PERMISSION },
+        { "peration not permitted", MF_PERMISSION },
+        { "must be superuser", MF_PERMISSION },
+        { "is write-protected", MF_PERMISSION },
+        { "unknown filesystem type", MF_FS_TYPE },
+        { "wrong fs type", MF_FS_TYPE },
+        { "superblock", MF_FS_TYPE },
+        { "not a valid", MF_FS_TYPE },
+        { NULL, MF_NONE },
+    };
 
-    if(options.iocharset && fs->iocharset_format) {
-        if(!is_word_str(options.iocharset)) {
-            fprintf(stderr, _("Error: invalid charset name '%s'\n"),
-                    options.iocharset);
-            return -1;
+    *failed_option = 0;
+    if(status == 0)
+        return MF_NONE;
+    /* 32 is "mount failure"; anything else is not about the fs */
+    if(status != 32)
+        return MF_OTHER;
+
+    for(int i = 0; patterns[i].pattern; i++)
+        if(strstr(errors, patterns[i].pattern)) {
+            if(patterns[i].failure == MF_BAD_OPTION)
+                find_failed_option(errors);
+            return patterns[i].failure;
         }
-        /* VFAT and UTF-8 need special care, see bug #443514 and mount(1) */
-        if(!strcmp(fsname, "vfat") && utf8) {
-            debug("VFAT in a UTF-8 locale: using option utf8\n");
-            if(!strcmp(options.iocharset, "utf8")) {
-                debug(
-                    "filesystem is vfat and charset is utf-8: using iso8859-1\n"
-                    "You can change with the -c option");
-                snprintf(iocharset_opt, sizeof(iocharset_opt),
-                         ",utf8,iocharset=iso8859-1");
-            } else {
-                snprintf(iocharset_opt, sizeof(iocharset_opt),
-                         ",utf8,iocharset=%s", options.iocharset);
+    return MF_OTHER;
+}
+
+/**
+ * Remove the option name (alone or as name=value) from a comma-separated
+ * option string, in place.
+ * @return 1 if it was found, 0 otherwise
+ */
+static int
+strip_mount_option(char *mount_opts, const char *name)
+{
+    size_t len = strlen(name);
+    char *opt = mount_opts, *next;
+    int found = 0;
+
+    while(*opt) {
+        next = opt + strcspn(opt, ",");
+        if(!strncmp(opt, name, len) && (opt[len] == ',' || opt[len] == '=' ||
+                                        opt[len] == 0)) {
+            if(*next)
+                memmove(opt, next + 1, strlen(next + 1) + 1);
+            else {
+                /* last one: also drop the comma before it */
+                if(opt > mount_opts)
+                    opt[-1] = 0;
+                *opt = 0;
             }
-        } else {
-            snprintf(iocharset_opt, sizeof(iocharset_opt), fs->iocharset_format,
-                     options.iocharset);
-        }
-    } else if(!strcmp(fsname, "vfat") && fs->iocharset_format) {
-        /* We still make a special case for vfat, as in certain cases,
-           mount will mount it with iocharset=utf8, some times without
-           warning. So, in the absence of a specified charset, we
-           force iocharset=iso8859-1*/
-        snprintf(iocharset_opt, sizeof(iocharset_opt), fs->iocharset_format,
-                 "iso8859-1");
+            found = 1;
+        } else
+            opt = *next ? next + 1 : next;
     }
+    return found;
+}
 
-    snprintf(mount_opts, sizeof(mount_opts), "%s%s%s%s%s%s%s%s%s%s%s",
-             fs->options, sync_opt, atime_opt, exec_opt, access_opt, ugid_opt,
-             umask_opt, fdmask_opt, iocharset_opt, utc_opt,
-             selinux_context_opt);
-
-    /* go for it */
-    return spawnl(SPAWN_EROOT | SPAWN_RROOT |
-                      (suppress_errors ? SPAWN_NO_STDERR : 0),
-                  MOUNTPROG, MOUNTPROG, "-t", fsname, "-o", mount_opts, device,
-                  mntpt, (char *)NULL);
+/**
+ * Print the error output of the last mount and what it means.
+ */
+static void
+report_mount_failure(const char *device)
+{
+    fputs(slurp_buffer, stderr);
+    switch(mount_failure) {
+    case MF_FS_TYPE:
+        if(options.use_fstype)
+            break; /* mount said it all */
+        fprintf(stderr,
+                _("Error: no supported file system could be mounted from "
+                  "%s\n"),
+                device);
+        break;
+    case MF_BAD_OPTION:
+        if(*failed_option)
+            fprintf(stderr, _("Error: the mount option '%s' was refused\n"),
+                    failed_option);
+        else
+            fputs(_("Error: a mount option was refused\n"), stderr);
+        break;
+    case MF_NO_MEDIUM:
+        fprintf(stderr, _("Error: no medium found in %s\n"), device);
+        break;
+    case MF_BUSY:
+        fputs(_("Error: the device or the mount point is busy\n"), stderr);
+        break;
+    case MF_PERMISSION:
+        fputs(_("Error: the mount was not permitted\n"), stderr);
+        break;
+    default:
+        break;
+    }
 }
 
 /**
- * Try to call do_mount() with every supported file system until a call
- * succeeds.
+ * Raise to full privileges and call mount with given file system. Exits the
+ * program immediately if MOUNTPROG cannot be executed or the given file system
+ * is invalid. NOTE: This function must not exit() since it is called in a
+ * lock-unlock-block.
+ *
+ * The error output of mount is kept in slurp_buffer, and the failure is
+ * classified into mount_failure. A refused option is dropped and the mount
+ * retried, as long as mount names options it refuses that can be dropped
+ * (or refuses iocharset without saying which).
  * @param device device node to mount
  * @param mntpt desired mount point
+ * @param fsname file system name (mount option -t)
  * @param utf8 is true if the option utf8 should be used for VFAT
- * @return last return value of do_mount (i. e. 0 on success, != 0 on error)
+ * @return exit status of mount, or -1 on failure.
  */
 static int
-do_mount_auto(const char *device, const char *mntpt, int utf8)
+do_mount(const char *device, const char *mntpt, const char *fsname, int utf8)
 {
     const struct FS *fs;
-    int nostderr = 1;
-    int result = -1;
+    char mount_opts[1000];
+    const char *drop;
+    int result, attempt = 0;
+
+    fs = build_mount_options(fsname, utf8, mount_opts, sizeof(mount_opts));
+    if(!fs) {
+        mount_failure = MF_OTHER;
+        *slurp_buffer = 0;
+        return -1;
+    }
+
+    for(;;) {
+        /* go for it */
+        result = spawnl(SPAWN_EROOT | SPAWN_RROOT | SPAWN_SLURP_STDERR,
+                        MOUNTPROG, MOUNTPROG, "-t", fsname, "-o", mount_opts,
+                        device, mntpt, (char *)NULL);
+        mount_failure = classify_mount_failure(result, slurp_buffer);
+        if(mount_failure == MF_NONE) {
+            /* warnings, like "write-protected, mounted read-only" */
+            fputs(slurp_buffer, stderr);
+            mounted_fs = fs;
+            metrics_set_fstype(fs->fsname);
+            break;
+        }
+        debug("mount -t %s failed (class %d): %s", fsname, mount_failure,
+              slurp_buffer);
+        if(mount_failure != MF_BAD_OPTION)
+            break;
+
+        /* when mount does not say which, iocharset once is the guess */
+        if(*failed_option)
+            drop = failed_option;
+        else if(attempt++ == 0)
+            drop = "iocharset";
+        else
+            break;
+        for(int i = 0; kept_options[i]; i++)
+            if(!strcmp(drop, kept_options[i]))
+                drop = NULL;
+        if(!drop || !strip_mount_option(mount_opts, drop))
+            break;
+        debug("retrying without the option %s\n", drop);
+    }
+    return result;
+}
+
+/**
+ * Whether do_mount_auto() tries the given file system: fs marked as
+ * skip_autodetect are skipped, unless it is ntfs-3g and we can stat
+ * MOUNT_NTFS_3G.
+ */
+static int
+fs_autodetectable(const struct FS *fs)
+{
     struct stat buf; /* Not used */
 
-    /* First, if that is supported, we try with blkid */
+    return !fs->skip_autodetect ||
+           (!strcmp(fs->fsname, "ntfs-3g") && !stat(MOUNT_NTFS_3G, &buf));
+}
+
+/**
+ * The file system to give to do_mount() for a detected type: ntfs is
+ * mounted with ntfs-3g if it is installed.
+ * @return the type (to be freed)
+ */
+static char *
+mount_fs_type(const char *type)
+{
+    struct stat buf; /* Not used */
+    char *tp;
+
+    if(!strcmp(type, "ntfs") && !stat(MOUNT_NTFS_3G, &buf)) {
+        debug("detected ntfs and ntfs-3g was found. Using ntfs-3g\n");
+        type = "ntfs-3g";
+    }
+    if(!(tp = strdup(type))) {
+        perror("strdup(type)");
+        exit(E_INTERNAL);
+    }
+    return tp;
+}
+
+/**
+ * Detect the file system type of the device with blkid, if that is supported.
+ * @return the type to give to do_mount() (to be freed), or NULL if unknown
+ */
+static char *
+detect_fs_type(const char *device)
+{
+    char *tp = NULL;
 #ifdef HAVE_BLKID
-    const char *tp;
     blkid_cache c;
+
     blkid_get_cache(&c, "/dev/null");
     get_root();
     tp = blkid_get_tag_value(c, "TYPE", device);
     drop_root();
+    blkid_put_cache(c);
     if(tp) {
+        char *fstype;
+
         debug("blkid gave FS %s for '%s'\n", tp, device);
-        if(!strcmp(tp, "ntfs") && !stat(MOUNT_NTFS_3G, &buf)) {
-            debug(
-                "blkdid detected ntfs and ntfs-3g was found. Using ntfs-3g\n");
-            tp = "ntfs-3g";
-        }
-        result = do_mount(device, mntpt, tp, utf8, nostderr);
-        if(result == 0)
+        fstype = mount_fs_type(tp);
+        free(tp);
+        tp = fstype;
+    }
+#else
+    (void)device;
+#endif /* HAVE_BLKID */
+    return tp;
+}
+
+/**
+ * Detect what an image file holds, with the prober of --probe, before a
+ * loop device is attached to it. The file is read with the rights of the
+ * user, who has to be able to read it for losetup anyway.
+ * @return the type, as blkid names it (vfat, crypto_LUKS, dos...), or NULL
+ * if the image holds nothing known or cannot be read
+ */
+static const char *
+detect_image_type(const char *image)
+{
+    const char *type = NULL;
+    unsigned char *header;
+    ssize_t size;
+    int fd;
+
+    if((fd = open(image, O_RDONLY | O_CLOEXEC)) < 0) {
+        debug("open(%s): %s\n", image, strerror(errno));
+        return NULL;
+    }
+    if(!(header = malloc(PROBE_READ_SIZE))) {
+        perror("malloc");
+        exit(E_INTERNAL);
+    }
+    size = pread(fd, header, PROBE_READ_SIZE, 0);
+    close(fd);
+    if(size > 0)
+        type = probe_classify(header, size);
+    free(header);
+    debug("image %s holds %s\n", image, type ? type : "nothing known");
+    return type;
+}
+
+/**
+ * Try to call do_mount() with every supported file system until a call
+ * succeeds.
+ * @param device device node to mount
+ * @param node what blkid reads to detect the type of device: the
+ *        /proc/self/fd/ path of the opened device, or device itself
+ * @param mntpt desired mount point
+ * @param utf8 is true if the option utf8 should be used for VFAT
+ * @param detected file system type already detected (on the image of a
+ *        loop device), tried first instead of asking blkid, or NULL
+ * @return last return value of do_mount (i. e. 0 on success, != 0 on error)
+ */
+static int
+do_mount_auto(const char *device, const char *node, const char *mntpt,
+              int utf8, const char *detected)
+{
+    const struct FS *fs;
+    int result = -1, attempts = 0;
+    char *tp;
+
+    /* First, if that is supported, we try with blkid */
+    tp = detected ? mount_fs_type(detected) : detect_fs_type(node);
+    if(tp) {
+        result = do_mount(device, mntpt, tp, utf8);
+        free(tp);
+        attempts = 1;
+        if(result == 0 || mount_failure != MF_FS_TYPE) {
+            metrics_observe(MH_DETECT, attempts);
+            if(result)
+                report_mount_failure(device);
             return result;
+        }
         debug("blkid-detected FS failed, trying manually \n");
     }
-    blkid_put_cache(c);
-#endif /* HAVE_BLKID */
 
     result = -1;
 
     for(fs = get_supported_fs(); fs->fsname; ++fs) {
-        /* Skip fs marked as such unless it is ntfs-3g and
-           we can stat MOUNT_NTFS_3G
-        */
-        if(fs->skip_autodetect &&
-           !(!strcmp(fs->fsname, "ntfs-3g") && !stat(MOUNT_NTFS_3G, &buf)))
+        if(!fs_autodetectable(fs))
             continue; /* skip fs that are marked as such */
-        /* don't suppress stderr if we try the last possible fs */
-        if((fs + 1)->fsname == NULL)
-            nostderr = 0;
-        result = do_mount(device, mntpt, fs->fsname, utf8, nostderr);
+        result = do_mount(device, mntpt, fs->fsname, utf8);
+        attempts++;
         if(result == 0)
             break;
 
-        /* sometimes VFAT fails when using iocharset; try again without */
-        if(options.iocharset)
-            result = do_mount(device, mntpt, fs->fsname, utf8, nostderr);
-        if(result <= 0)
+        /* trying other file systems only helps if that one was wrong;
+           one that refuses options which cannot be dropped is taken as
+           wrong too, as it may not even have looked at the device */
+        if(mount_failure != MF_FS_TYPE && mount_failure != MF_BAD_OPTION)
             break;
     }
+    if(attempts)
+        metrics_observe(MH_DETECT, attempts);
+    if(result)
+        report_mount_failure(device);
     return result;
 }
 
+/**
+ * Print one policy verdict of the --explain plan.
+ * @return verdict
+ */
+static int
+explain_verdict(const char *check, int verdict)
+{
+    explain("policy", "%s: %s", check, verdict ? _("yes") : _("no"));
+    return verdict;
+}
+
+/**
+ * Run the policy checks and the detection a mount of device would go
+ * through, and print the plan: policy verdicts, LUKS and file system types,
+ * and the helper commands that would be run, with their mount options. Apart
+ * from reads, nothing is done on the system, and the device is not even
+ * read if the mount would be denied.
+ * @param device device node (or loop image, if doing_loop)
+ * @param dev device, as opened; its fd is -1 if it could not be (or if
+ *        doing_loop)
+ * @param mntpt mount point that would be used
+ * @param doing_loop true if device is an image that would be attached
+ * @param utf8 is true if the option utf8 should be used for VFAT
+ * @param detected file system of the image, if doing_loop and known
+ * @return 0 if the mount would be allowed, E_POLICY otherwise
+ */
+static int
+explain_mount(const char *device, const struct device_handle *dev,
+              const char *mntpt, int doing_loop, int utf8,
+              const char *detected)
+{
+    const struct FS *fs;
+    char mount_opts[1000];
+    char *label, *target, *tp = NULL;
+    int allowed = 1, encrypted;
+
+    if(doing_loop)
+        explain("policy", _("loop image: device checks are left to losetup"));
+    else {
+        allowed &= explain_verdict(_("block device"), dev->fd >= 0);
+        allowed &= explain_verdict(_("not mounted yet"),
+                                   !device_mounted(device, 0, NULL));
+        allowed &= explain_verdict(
+            _("allowlisted or removable"),
+            device_allowlisted(device) ||
+                (dev->fd >= 0 && device_handle_removable(dev)));
+        allowed &= explain_verdict(_("not locked"), !device_locked(device));
+    }
+    allowed &= explain_verdict(_("mount point usable"),
+                               mntpt_would_be_valid(mntpt));
+    allowed &= explain_verdict(_("mount point free"),
+                               !mntpt_mounted(mntpt, 0));
+    explain("policy", allowed ? _("verdict: allowed") : _("verdict: denied"));
+    explain_time("policy");
+    /* the device is only read (as root) once it may be mounted */
+    if(!allowed)
+        return E_POLICY;
+
+    /* LUKS; an image was read as the user by detect_image_type() */
+    label = strreplace(device, '/', '_');
+    if(dev->fd >= 0)
+        encrypted = luks_is_encrypted(dev->proc_path);
+    else
+        encrypted = detected && !strcmp(detected, "crypto_LUKS");
+    if(encrypted) {
+        explain("luks", _("LUKS encrypted, would run: %s luksOpen%s %s %s"),
+                CRYPTSETUPPROG,
+                options.force_write == FW_RO ? " --readonly" : "", device,
+                label);
+        if(asprintf(&target, "/dev/mapper/%s", label) == -1) {
+            perror("asprintf");
+            free(label);
+            return E_INTERNAL;
+        }
+    } else {
+        explain("luks", _("not encrypted"));
+        target = strdup(device);
+        if(!target) {
+            perror("strdup(device)");
+            free(label);
+            return E_INTERNAL;
+        }
+    }
+    free(label);
+    explain_time("luks");
+
+    if(options.run_fsck)
+        explain("fsck", _("would run: %s -C1 %s"), FSCKPROG, target);
+
+    /* file system type */
+    if(options.use_fstype)
+        explain("detect", _("type given on the command line: %s"),
+                options.use_fstype);
+    else if(encrypted)
+        explain("detect", _("type unknown until the device is unlocked"));
+    else if(doing_loop && detected) {
+        tp = mount_fs_type(detected);
+        explain("detect", _("image: %s"), tp);
+    } else if(dev->fd >= 0) {
+        tp = detect_fs_type(dev->proc_path);
+        explain("detect", tp ? _("blkid: %s") : _("blkid: no type found"),
+                tp);
+    } else
+        explain("detect", _("type unknown until the image is attached"));
+    explain_time("detect");
+
+    /* candidates, in the order do_mount_auto() tries them */
+    if(options.use_fstype || tp) {
+        fs = build_mount_options(options.use_fstype ? options.use_fstype : tp,
+                                 utf8, mount_opts, sizeof(mount_opts));
+        if(fs)
+            explain("mount", _("would run: %s -t %s -o %s %s %s"), MOUNTPROG,
+                    fs->fsname, mount_opts, target, mntpt);
+    }
+    if(!options.use_fstype)
+        for(fs = get_supported_fs(); fs->fsname; ++fs)
+            if(fs_autodetectable(fs) &&
+               build_mount_options(fs->fsname, utf8, mount_opts,
+                                   sizeof(mount_opts)))
+                explain("mount",
+                        _("would try: %s -t %s -o %s %s %s"), MOUNTPROG,
+                        fs->fsname, mount_opts, target, mntpt);
+    if(options.idmap)
+        explain("mount", _("file systems without uid= would be ID-mapped"));
+    if(options.overlay && conffile_overlay_size())
+        explain("mount", _("would stack an overlay on a tmpfs of %u MiB"),
+                conffile_overlay_size());
+    else if(options.overlay)
+        explain("mount", _("would stack an overlay on a tmpfs"));
+    explain_time("mount");
+
+    free(tp);
+    free(target);
+    return 0;
+}
+
 /**
  * Lock given device.
  * param pid pid of program that holds the lock
@@ -673,6 +1241,245 @@ clean_lock_dir(const char *device)
     free(lockdirpath);
 }
 
+/**
+ * Adds device to the list of devices to probe.
+ */
+static void
+probe_add(struct probe_result **results, size_t *n, char *device)
+{
+    struct probe_result *r = realloc(*results, (*n + 1) * sizeof(**results));
+
+    if(!r) {
+        perror("realloc");
+        exit(E_INTERNAL);
+    }
+    r[*n].device = device;
+    *results = r;
+    (*n)++;
+}
+
+/**
+ * Prints the type of each device, read in one batch; with no device,
+ * of all the removable and allowlisted ones.
+ *
+ * @return 0 on success, E_DEVICE if a device could not be probed
+ */
+static int
+do_probe(char *const devices[], int count)
+{
+    struct probe_result *results = NULL;
+    enum probe_engine engine;
+    size_t n = 0;
+    int rc = 0;
+
+    if(!count) {
+        DIR *dir = opendir("/sys/class/block");
+        struct dirent *entry;
+        char *device;
+
+        if(!dir) {
+            perror(_("Error: could not open /sys/class/block"));
+            return E_INTERNAL;
+        }
+        while((entry = readdir(dir))) {
+            if(entry->d_name[0] == '.')
+                continue;
+            if(asprintf(&device, "/dev/%s", entry->d_name) == -1) {
+                perror("asprintf");
+                exit(E_INTERNAL);
+            }
+            if(is_block(device) && (device_allowlisted(device) ||
+                                    device_removable_silent(device)))
+                probe_add(&results, &n, device);
+            else
+                free(device);
+        }
+        closedir(dir);
+    }
+
+    for(int i = 0; i < count; i++) {
+        char *device = realpath(devices[i], NULL);
+
+        if(!device) {
+            fprintf(stderr, _("Error: could not find %s: %s\n"), devices[i],
+                    strerror(errno));
+            rc = E_DEVICE;
+        } else if(device_valid(device) && (device_allowlisted(device) ||
+                                           device_removable(device)))
+            probe_add(&results, &n, device);
+        else {
+            free(device);
+            rc = E_DEVICE;
+        }
+    }
+
+    recorder_phase("probe");
+    engine = probe_devices(results, n, PROBE_AUTO);
+    debug("probed %zu devices with %s\n", n,
+          engine == PROBE_URING     ? "io_uring"
+          : engine == PROBE_THREADS ? "threads"
+                                    : "pread");
+    for(size_t i = 0; i < n; i++) {
+        if(results[i].error) {
+            fprintf(stderr, _("Error: could not read %s: %s\n"),
+                    results[i].device, strerror(results[i].error));
+            rc = E_DEVICE;
+        } else
+            printf("%s: %s\n", results[i].device,
+                   results[i].type ? results[i].type : _("unknown"));
+        free((char *)results[i].device);
+    }
+    free(results);
+    return rc;
+}
+
+/**
+ * Checks that device may be unlocked and mounted by --multiple: the
+ * policy checks that do not depend on the mount point.
+ * @return 1 if it may, 0 otherwise (and the reason has been printed)
+ */
+static int
+multiple_device_allowed(const char *device)
+{
+    if(!device_valid(device))
+        return 0;
+    if(device_mounted(device, 0, NULL)) {
+        fprintf(stderr, _("Error: device %s is already mounted\n"), device);
+        return 0;
+    }
+    if(!device_allowlisted(device) && !device_removable(device))
+        return 0;
+    if(device_locked(device)) {
+        fprintf(stderr, _("Error: device %s is locked\n"), device);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Mounts several devices on their default mount points. The encrypted
+ * ones are opened first, all together and with a single passphrase;
+ * then each device is mounted in turn by a child going through the
+ * usual mount.
+ *
+ * @return the exit status (the first error, if any) in the parent; -1 in
+ *         the children, after setting *devarg to the device to mount
+ */
+static int
+do_multiple(char *const devices[], int count, char **devarg)
+{
+    struct luks_unlock *unlock = calloc(count, sizeof(*unlock));
+    int rc = 0;
+
+    if(!unlock) {
+        perror("calloc");
+        return E_INTERNAL;
+    }
+
+    recorder_phase("resolve");
+    for(int i = 0; i < count; i++) {
+        char *identdev = NULL, *device;
+
+        if(ident_resolve(devices[i], &identdev) == -1) {
+            rc = rc ? rc : E_DEVICE;
+            continue;
+        }
+        device = realpath(identdev ? identdev : devices[i], NULL);
+        free(identdev);
+        if(!device) {
+            device_valid(devices[i]);
+            rc = rc ? rc : E_DEVICE;
+        } else if(!multiple_device_allowed(device)) {
+            free(device);
+            rc = rc ? rc : E_POLICY;
+        } else
+            unlock[i].device = device;
+    }
+
+    /* the devices that passed, packed in front */
+    int n = 0;
+    int *index = malloc(count * sizeof(int));
+    if(!index) {
+        perror("malloc");
+        return E_INTERNAL;
+    }
+    for(int i = 0; i < count; i++)
+        if(unlock[i].device) {
+            index[n] = i;
+            unlock[n++] = unlock[i];
+        }
+
+    recorder_phase("luks");
+    luks_decrypt_many(unlock, n, options.passphrase,
+                      options.force_write == FW_RO,
+                      conffile_luks_unlock_memory() * 1024UL);
+
+    for(int i = 0; i < n; i++) {
+        struct luks_unlock *u = &unlock[i];
+        int status;
+        pid_t pid;
+
+        switch(u->status) {
+        case DECRYPT_FAILED:
+            if(u->error == 2)
+                fprintf(stderr,
+                        _("Error: could not decrypt %s (wrong passphrase?)\n"),
+                        u->device);
+            else
+                fprintf(stderr,
+                        _("Error: could not decrypt %s (cryptsetup status "
+                          "%d)\n"),
+                        u->device, u->error);
+            rc = rc ? rc : E_POLICY;
+            continue;
+        case DECRYPT_EXISTS:
+            fprintf(stderr, _("Error: mapped device %s already exists\n"),
+                    u->decrypted);
+            rc = rc ? rc : E_POLICY;
+            continue;
+        default:
+            break;
+        }
+
+        fflush(stdout);
+        pid = fork();
+        if(pid == -1) {
+            recorder_error("fork");
+            perror(_("Impossible to fork"));
+            return E_INTERNAL;
+        }
+        if(pid == 0) {
+            recorder_fork();
+            options.mode = MOUNT;
+            options.unlocked = u->status == DECRYPT_OK;
+            *devarg = devices[index[i]];
+            metrics_init(MO_MOUNT);
+            return -1;
+        }
+        recorder_event(REC_SPAWN, pid, u->device);
+        if(waitpid(pid, &status, 0) < 0) {
+            recorder_error("wait");
+            perror("Error: could not wait for executed subprocess");
+            return E_INTERNAL;
+        }
+        status = WIFEXITED(status) ? WEXITSTATUS(status) : E_INTERNAL;
+        recorder_event(REC_CHILD, status, u->device);
+        if(status) {
+            struct stat st;
+
+            /* the mount was not reached: do not leave the mapping open */
+            if(u->status == DECRYPT_OK && !stat(u->decrypted, &st))
+                luks_release(u->decrypted, 0);
+            rc = rc ? rc : status;
+        }
+        free(u->decrypted);
+        free((char *)u->device);
+    }
+    free(index);
+    free(unlock);
+    return rc;
+}
+
 /**
  * Entry point.
  */
@@ -680,24 +1487,34 @@ int
 main(int argc, char *argv[])
 {
     char *devarg = NULL, *arg2 = NULL;
-    char *device, *mntptdev, *decrypted_device;
+    char *device, *mntptdev, *identdev = NULL, *decrypted_device;
     const char *fstab_device;
     int is_real_path = 0;
     int doing_loop_mount = 0;
+    const char *image_type = NULL;
+    bool args_ok = true;
     int utf8;
     int result;
+    struct timespec phase_start;
 
     const struct option long_opts[] = {
         { "charset", 1, NULL, 'c' },
         { "debug", 0, NULL, 'd' },
         { "dmask", 1, NULL, 0 },
         { "exec", 0, NULL, 'e' },
+        { "explain", 0, NULL, 0 },
         { "fmask", 1, NULL, 0 },
         { "fsck", 0, NULL, 'F' },
         { "help", 0, NULL, 'h' },
+        { "idempotent", 0, NULL, 0 },
+        { "idmap", 0, NULL, 0 },
         { "lock", 0, NULL, 'l' },
+        { "metrics", 0, NULL, 0 },
+        { "multiple", 0, NULL, 0 },
         { "noatime", 0, NULL, 'A' },
+        { "overlay", 0, NULL, 0 },
         { "passphrase", 1, NULL, 'p' },
+        { "probe", 0, NULL, 0 },
         { "read-only", 0, NULL, 'r' },
         { "read-write", 0, NULL, 'w' },
         { "selinux-context", 0, (int *)&options.use_selinux_context, true },
@@ -710,10 +1527,7 @@ main(int argc, char *argv[])
         { NULL, 0, NULL, 0 },
     };
 
-    /* initialize locale */
-    setlocale(LC_ALL, "");
-    bindtextdomain("pmount", NULL);
-    textdomain("pmount");
+    recorder_init("pmount");
 
     /* If pmount is run without a single argument, print out the list
        of removable devices. Does not require root privileges, just read access
@@ -741,6 +1555,20 @@ main(int argc, char *argv[])
                 options.dmask = optarg;
             else if(strcmp(long_opts[option_index].name, "fmask") == 0)
                 options.fmask = optarg;
+            else if(strcmp(long_opts[option_index].name, "idmap") == 0)
+                options.idmap = true;
+            else if(strcmp(long_opts[option_index].name, "overlay") == 0)
+                options.overlay = true;
+            else if(strcmp(long_opts[option_index].name, "idempotent") == 0)
+                options.idempotent = true;
+            else if(strcmp(long_opts[option_index].name, "explain") == 0)
+                options.explain = true;
+            else if(strcmp(long_opts[option_index].name, "metrics") == 0)
+                return metrics_print(stdout) ? E_INTERNAL : EXIT_SUCCESS;
+            else if(strcmp(long_opts[option_index].name, "probe") == 0)
+                options.mode = PROBE;
+            else if(strcmp(long_opts[option_index].name, "multiple") == 0)
+                options.mode = MULTIPLE;
             break;
         case 'A':
             options.noatime = true;
@@ -808,17 +1636,51 @@ main(int argc, char *argv[])
     if(optind + 1 < argc)
         arg2 = argv[optind + 1];
 
-    /* check number of arguments */
-    if(!devarg || (options.mode != MOUNT && !arg2) || argc > optind + 2) {
+    /* check number of arguments: --probe takes any number of devices,
+       --multiple at least one (and does not explain) */
+    if(options.mode == MULTIPLE)
+        args_ok = devarg && !options.explain;
+    else if(options.mode != PROBE)
+        args_ok = devarg && (options.mode == MOUNT || arg2) &&
+                  argc <= optind + 2;
+    if(!args_ok) {
         usage(argv[0]);
         return E_ARGS;
     }
 
+    /* mounts are measured from here on */
+    if(options.mode == MOUNT && !options.explain)
+        metrics_init(MO_MOUNT);
+
     if(conffile_system_read()) {
         fputs(_("Error while reading system configuration file\n"), stderr);
         return E_INTERNAL;
     }
 
+    if(options.idmap && !conffile_allow_idmap()) {
+        fputs(_("Your system administrator does not "
+                "allow users to use ID-mapped mounts, aborting\n"),
+              stderr);
+        return E_DISALLOWED;
+    }
+
+    if(options.overlay) {
+        if(!conffile_allow_overlay()) {
+            fputs(_("Your system administrator does not "
+                    "allow users to use overlays, aborting\n"),
+                  stderr);
+            return E_DISALLOWED;
+        }
+        if(options.force_write == FW_RW) {
+            fputs(_("Error: --overlay mounts the device read-only, it "
+                    "cannot go with -w\n"),
+                  stderr);
+            return E_ARGS;
+        }
+        /* the device (or image) is never written to */
+        options.force_write = FW_RO;
+    }
+
     /* are we root? */
     if(!check_root()) {
         fputs(_("Error: this program needs to be installed suid root\n"),
@@ -831,22 +1693,50 @@ main(int argc, char *argv[])
     drop_root();
     drop_groot();
 
+    if(options.explain)
+        clock_gettime(CLOCK_MONOTONIC, &explain_clock);
+
     /* Check if the user is physically logged in */
     ensure_user_physically_logged_in(argv[0]);
 
-    /* Lookup in /etc/fstab if devarg is a mount point, unless we already
-       have a block device -- this way, pmount shouldn't choke on stale
-       network mounts. */
+    if(options.mode == PROBE)
+        return do_probe(argv + optind, argc - optind);
+
+    /* the parent returns, each child goes on with one device */
+    if(options.mode == MULTIPLE) {
+        result = do_multiple(argv + optind, argc - optind, &devarg);
+        if(result >= 0)
+            return result;
+        arg2 = NULL;
+    }
 
-    if(!is_block(devarg) && fstab_has_mntpt("/etc/fstab", devarg, &mntptdev)) {
-        debug("resolved mount point %s to device %s\n", devarg, mntptdev);
-        devarg = mntptdev;
+    /* LABEL=, UUID=... identifiers are resolved to the device node, but
+       devarg is kept to name the mount point */
+    recorder_phase("resolve");
+    switch(ident_resolve(devarg, &identdev)) {
+    case -1:
+        return E_DEVICE;
+    case 0:
+        /* Lookup in /etc/fstab if devarg is a mount point, unless we
+           already have a block device -- this way, pmount shouldn't choke
+           on stale network mounts. */
+        if(!is_block(devarg) &&
+           fstab_has_mntpt("/etc/fstab", devarg, &mntptdev)) {
+            debug("resolved mount point %s to device %s\n", devarg, mntptdev);
+            devarg = mntptdev;
+        }
+        break;
     }
 
     /* get real path, if possible */
-    if((device = realpath(devarg, NULL))) {
+    if((device = realpath(identdev ? identdev : devarg, NULL))) {
         debug("resolved %s to device %s\n", devarg, device);
         is_real_path = 1;
+        free(identdev);
+    } else if(identdev) {
+        /* not created yet or gone: let the policy checks report it */
+        device = identdev;
+        is_real_path = 1;
     } else {
         debug("realpath(%s): %s\n", devarg, strerror(errno));
         device = strdup(devarg);
@@ -868,11 +1758,12 @@ main(int argc, char *argv[])
 
         do_mount_fstab(fstab_device);
         free(device);
-        return E_EXECMOUNT;
+        return options.explain ? EXIT_SUCCESS : E_EXECMOUNT;
     }
 
     if(is_real_path && (!is_block(device))) {
         char *loop_device;
+        int loop_readonly;
         if(!conffile_allow_loop()) {
             fprintf(stderr,
                     _("You are trying to mount %s as a loopback device. \n"
@@ -881,14 +1772,60 @@ main(int argc, char *argv[])
             free(device);
             return E_DISALLOWED;
         }
-        if(loopdev_associate(device, &loop_device)) {
+        /* images we may only read (or that must not be written) are
+           attached read-only */
+        loop_readonly = options.force_write == FW_RO ||
+                        (options.force_write == FW_DEFAULT &&
+                         access(device, W_OK) != 0);
+        if(loop_readonly && options.force_write == FW_DEFAULT) {
+            debug("%s is not writable, attaching it read-only\n", device);
+            options.force_write = FW_RO;
+        }
+        /* an image the user cannot read is nobody's business */
+        if(options.idempotent && options.mode == MOUNT && !options.explain &&
+           !access(device, R_OK)) {
+            result = already_mounted(device, 1, arg2);
+            if(result) {
+                free(device);
+                return result > 0 ? EXIT_SUCCESS : E_POLICY;
+            }
+        }
+        /* no loop device for images that hold a partition table rather
+           than a file system; those the prober knows are not probed
+           again once attached, the others are left to blkid (on the
+           loop device) and to the trial mounts */
+        image_type = detect_image_type(device);
+        if(image_type &&
+           (!strcmp(image_type, "dos") || !strcmp(image_type, "gpt"))) {
+            if(!options.use_fstype) {
+                fprintf(stderr,
+                        _("Error: %s holds no file system pmount can mount, "
+                          "not attaching it\n"),
+                        devarg);
+                free(device);
+                return E_EXECMOUNT;
+            }
+            image_type = NULL;
+        } else if(image_type && !strcmp(image_type, "crypto_LUKS"))
+            /* what it holds is only known once unlocked */
+            image_type = NULL;
+        if(options.explain) {
+            /* the image itself stands for the loop device from now on */
+            explain("resolve", _("%s is an image file"), device);
+            explain_time("resolve");
+            explain("loop",
+                    _("would attach %s to a free device of loop_devices%s"),
+                    device, loop_readonly ? _(", read-only") : "");
+            explain_time("loop");
+        } else if(loopdev_associate(device, &loop_device, loop_readonly)) {
             fprintf(stderr, _("Failed to setup loop device for %s, aborting\n"),
                     devarg);
             free(device);
             return E_LOSETUP;
+        } else {
+            free(device);
+            device = loop_device;
         }
-        free(device);
-        device = loop_device;
         /* For bypassing policy check afterwards, we've done
            everything already.
         */
@@ -900,7 +1837,7 @@ main(int argc, char *argv[])
         /* try to prepend '/dev' */
         if(strncmp(device, DEVDIR, sizeof(DEVDIR) - 1) != 0) {
             char *dev_device, *realpath_dev_device;
-            if(asprintf(&dev_device, "%s%s", DEVDIR, device)) {
+            if(asprintf(&dev_device, "%s%s", DEVDIR, device) == -1) {
                 perror("asprintf");
                 free(device);
                 return E_INTERNAL;
@@ -927,13 +1864,14 @@ main(int argc, char *argv[])
 
                 do_mount_fstab(fstab_device);
                 free(device);
-                return E_EXECMOUNT;
+                return options.explain ? EXIT_SUCCESS : E_EXECMOUNT;
             }
         }
     }
 
     /* does the device start with DEVDIR? */
-    if(strncmp(device, DEVDIR, sizeof(DEVDIR) - 1) != 0) {
+    if(!(options.explain && doing_loop_mount) &&
+       strncmp(device, DEVDIR, sizeof(DEVDIR) - 1) != 0) {
         fprintf(stderr, _("Error: invalid device %s (must be in /dev/)\n"),
                 device);
         free(device);
@@ -942,6 +1880,37 @@ main(int argc, char *argv[])
 
     switch(options.mode) {
     case MOUNT: {
+        struct device_handle dev;
+
+        recorder_event(REC_DEVICE, 0, device);
+        /* the node is looked up once: from now on, everything acts on
+           the device found then */
+        if(options.explain && doing_loop_mount)
+            dev.fd = -1; /* the image has no device yet */
+        else if(device_open(&dev, device) && !options.explain) {
+            if(doing_loop_mount)
+                loopdev_dissociate(device);
+            free(device);
+            return E_POLICY;
+        }
+
+        /* only a device the user may mount can be reported as mounted;
+           the rest is left to check_mount_policy(), which refuses it */
+        if(options.idempotent && !doing_loop_mount && !options.explain &&
+           (device_allowlisted(dev.path) ||
+            device_removable_silent(dev.path))) {
+            result = already_mounted(dev.path, 0, arg2);
+            if(result) {
+                device_close(&dev);
+                free(device);
+                return result > 0 ? EXIT_SUCCESS : E_POLICY;
+            }
+        }
+
+        /* get the headers on their way while we check the policy */
+        if(dev.fd >= 0)
+            prefetch_device_headers(&dev);
+
         /* determine mount point name; note that we use devarg instead of
          * device to preserve symlink names (like '/dev/usbflash' instead
          * of '/dev/sda1') */
@@ -956,6 +1925,8 @@ main(int argc, char *argv[])
         /* if no charset was set explicitly, autodetect UTF-8 */
         if(!options.iocharset) {
             const char *codeset;
+            /* messages only set up the locale when they are printed */
+            setlocale(LC_CTYPE, "");
             codeset = nl_langinfo(CODESET);
 
             debug("no iocharset given, current locale encoding is %s\n",
@@ -973,10 +1944,36 @@ main(int argc, char *argv[])
             utf8 = strcmp(options.iocharset, "utf8") == 0;
         }
 
+        /* a charset the kernel cannot load would make every mount
+           attempt fail: go without it */
+        if(options.iocharset && is_word_str(options.iocharset) &&
+           !nls_available(options.iocharset, !options.explain)) {
+            fprintf(stderr,
+                    _("Warning: the kernel has no NLS table for charset %s, "
+                      "mounting without it\n"),
+                    options.iocharset);
+            options.iocharset = NULL;
+        }
+
+        if(options.explain) {
+            explain("resolve", _("device %s, mount point %s"), device, mntpt);
+            explain_time("resolve");
+            /* for cryptsetup isLuks */
+            device_inherit(&dev, 1);
+            result = explain_mount(device, &dev, mntpt, doing_loop_mount,
+                                   utf8, image_type);
+            if(dev.fd >= 0)
+                device_close(&dev);
+            free(device);
+            free(mntpt);
+            return result;
+        }
+
         /* clean stale locks */
         clean_lock_dir(device);
 
-        if(check_mount_policy(device, mntpt, doing_loop_mount)) {
+        recorder_phase("policy");
+        if(check_mount_policy(&dev, mntpt, doing_loop_mount)) {
             if(doing_loop_mount)
                 loopdev_dissociate(device);
             free(device);
@@ -984,26 +1981,47 @@ main(int argc, char *argv[])
             return E_POLICY;
         }
 
-        /*
-           Here, we try to open the device, in order to check that
-           for instance medium is present.
-        */
-#ifdef ENOMEDIUM
-        get_root();
-        int fd = open(device, O_RDONLY);
-        if(fd == -1) {
-            perror(_("Could not open device"));
+        /* only mounts the policy allows take slots and device tokens:
+           others could drain them for devices they may not mount */
+        recorder_phase("admission");
+        if(admission_enter(device)) {
+            if(doing_loop_mount)
+                loopdev_dissociate(device);
+            free(device);
+            free(mntpt);
+            return E_ADMISSION;
+        }
+
+        /* the device was opened without waiting for a medium: check that
+           there is one */
+        if(!device_has_medium(&dev)) {
+            recorder_error("open device");
+            fprintf(stderr, "%s: %s\n", _("Could not open device"),
+                    strerror(ENOMEDIUM));
+            if(doing_loop_mount)
+                loopdev_dissociate(device);
             free(device);
             free(mntpt);
             return E_DEVICE;
         }
-        drop_root();
-#endif
 
-        /* check for encrypted device */
-        enum decrypt_status decrypt =
-            luks_decrypt(device, &decrypted_device, options.passphrase,
-                         options.force_write == FW_RO ? 1 : 0);
+        /* io.max limits of the helpers apply to this device */
+        helper_set_device(&dev);
+
+        /* check for encrypted device; cryptsetup opens it through the
+           descriptor */
+        recorder_phase("luks");
+        clock_gettime(CLOCK_MONOTONIC, &phase_start);
+        device_inherit(&dev, 1);
+        enum decrypt_status decrypt = luks_decrypt(
+            device, dev.proc_path, &decrypted_device, options.passphrase,
+            options.force_write == FW_RO ? 1 : 0);
+        device_inherit(&dev, 0);
+        if(decrypt == DECRYPT_EXISTS && options.unlocked)
+            /* opened by --multiple, the lockfile is there */
+            decrypt = DECRYPT_OK;
+        else if(decrypt != DECRYPT_NOTENCRYPTED)
+            metrics_observe(MH_LUKS, metrics_since(&phase_start));
 
         switch(decrypt) {
         case DECRYPT_FAILED:
@@ -1023,7 +2041,7 @@ main(int argc, char *argv[])
             return E_POLICY;
         case DECRYPT_OK:
             /* We create a luks lockfile _on the decrypted device !_*/
-            if(!luks_create_lockfile(decrypted_device))
+            if(!options.unlocked && !luks_create_lockfile(decrypted_device))
                 fputs(_("Warning: could not create luks lockfile\n"), stderr);
         case DECRYPT_NOTENCRYPTED:
             break;
@@ -1036,6 +2054,7 @@ main(int argc, char *argv[])
         }
 
         /* lock the mount directory */
+        recorder_phase("lock");
         debug("locking mount point directory\n");
         if(lock_dir(mntpt) < 0) {
             fputs(_("Error: could not lock the mount directory. Another pmount "
@@ -1051,7 +2070,10 @@ main(int argc, char *argv[])
 
         /* Now starting fsck if requested. */
         if(options.run_fsck) {
+            recorder_phase("fsck");
+            clock_gettime(CLOCK_MONOTONIC, &phase_start);
             result = do_fsck(decrypted_device);
+            metrics_observe(MH_FSCK, metrics_since(&phase_start));
             if(result)
                 fputs(_("Error: fsck failed, not mounting\n"), stderr);
         } else
@@ -1060,13 +2082,53 @@ main(int argc, char *argv[])
         /* Only mount if fsck went fine */
         if(!result) {
             /* off we go */
-            if(options.use_fstype)
+            recorder_phase("mount");
+            iostat_snapshot(decrypted_device, mntpt);
+            if(options.use_fstype) {
                 result = do_mount(decrypted_device, mntpt, options.use_fstype,
-                                  utf8, 0);
+                                  utf8);
+                if(result)
+                    report_mount_failure(decrypted_device);
+            } else if(decrypt == DECRYPT_NOTENCRYPTED)
+                result = do_mount_auto(decrypted_device, dev.proc_path, mntpt,
+                                       utf8, image_type);
             else
-                result = do_mount_auto(decrypted_device, mntpt, utf8);
+                result = do_mount_auto(decrypted_device, decrypted_device,
+                                       mntpt, utf8, NULL);
+        }
+
+        /* file systems that cannot take uid= get an ID-mapped mount;
+           the device is not mounted as asked without it */
+        if(!result && options.idmap && mounted_fs &&
+           !mounted_fs->support_ugid && idmap_mount(mntpt)) {
+            fputs(_("Error: could not set up an ID-mapped mount\n"), stderr);
+            /* nothing is left to unmount if the swap failed half-way */
+            spawnl(SPAWN_EROOT | SPAWN_RROOT | SPAWN_NO_STDERR, UMOUNTPROG,
+                   UMOUNTPROG, mntpt, (char *)NULL);
+            result = -1;
         }
 
+        /* the writable layer goes on top of it all; the device is not
+           mounted as asked without it */
+        if(!result && options.overlay &&
+           (result = overlay_mount(decrypted_device, mntpt,
+                                   conffile_overlay_size(), options.exec))) {
+            /* the tmpfs first, if it was left on top of the device */
+            if(result == -2)
+                spawnl(SPAWN_EROOT | SPAWN_RROOT, UMOUNTPROG, UMOUNTPROG,
+                       mntpt, (char *)NULL);
+            spawnl(SPAWN_EROOT | SPAWN_RROOT, UMOUNTPROG, UMOUNTPROG, mntpt,
+                   (char *)NULL);
+            result = -1;
+        }
+
+        /* for later --idempotent runs: this mount is the user's */
+        if(!result)
+            mount_owner_record(MOUNT_OWNER_DIR, mntpt, getuid());
+
+        /* detection is over, the prefetched headers may go */
+        device_close(&dev);
+
         /* unlock the mount point again */
         debug("unlocking mount point directory\n");
         unlock_dir(mntpt);
@@ -1089,6 +2151,7 @@ main(int argc, char *argv[])
             free(mntpt);
             return E_EXECMOUNT;
         }
+
         free(device);
         free(mntpt);
         return EXIT_SUCCESS;
@@ -1112,12 +2175,18 @@ main(int argc, char *argv[])
         }
         free(device);
         return 0;
+
+    case PROBE: /* handled before the device is resolved */
+    case MULTIPLE:
+        break;
     }
 
     fprintf(stderr, _("Internal error: mode %s not handled.\n"),
-            options.mode == MOUNT  ? "MOUNT"
-            : options.mode == LOCK ? "LOCK"
-                                   : "UNLOCK");
+            options.mode == MOUNT    ? "MOUNT"
+            : options.mode == LOCK   ? "LOCK"
+            : options.mode == UNLOCK ? "UNLOCK"
+            : options.mode == PROBE  ? "PROBE"
+                                     : "MULTIPLE");
     free(device);
     return E_INTERNAL;
 }
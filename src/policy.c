@@ -17,6 +17,7 @@
 #include <ctype.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <libintl.h>
 #include <limits.h>
 #include <mntent.h>
@@ -407,13 +408,20 @@ device_valid(const char *device)
     return 1;
 }
 
-const char *
-fstab_has_device(const char *fname, const char *device, char *mntpt, int *uid)
+const struct mntent *
+fstab_find_device(const char *fname, const char *device)
 {
     FILE *f;
     struct mntent *entry;
     char *pathbuf_arg;
-    static char fstab_device[PATH_MAX];
+    static char fstab_device[PATH_MAX], fstab_dir[PATH_MAX];
+    static char fstab_type[64], fstab_opts[1024];
+    static struct mntent found = {
+        .mnt_fsname = fstab_device,
+        .mnt_dir = fstab_dir,
+        .mnt_type = fstab_type,
+        .mnt_opts = fstab_opts,
+    };
     const char *realdev_arg;
 
     debug("Checking for device '%s' in '%s'\n", device, fname);
@@ -440,40 +448,55 @@ fstab_has_device(const char *fname, const char *device, char *mntpt, int *uid)
             realdev = fstab_device;
 
         if(!strcmp(realdev, realdev_arg)) {
-            if(mntpt) {
-                snprintf(mntpt, MEDIA_STRING_SIZE - 1, "%s", entry->mnt_dir);
-            }
-            if(uid) {
-                char *uidopt = hasmntopt(entry, "uid");
-                if(uidopt)
-                    uidopt = strchr(uidopt, '=');
-                if(uidopt) {
-                    ++uidopt; /* skip the '=' */
-                    /* FIXME: this probably needs more checking */
-                    *uid = atoi(uidopt);
-                } else
-                    *uid = -1;
-            }
+            snprintf(fstab_dir, sizeof(fstab_dir), "%s", entry->mnt_dir);
+            snprintf(fstab_type, sizeof(fstab_type), "%s", entry->mnt_type);
+            snprintf(fstab_opts, sizeof(fstab_opts), "%s", entry->mnt_opts);
+            found.mnt_freq = entry->mnt_freq;
+            found.mnt_passno = entry->mnt_passno;
 
             endmntent(f);
             free(pathbuf);
             free(pathbuf_arg);
             debug(" -> found as '%s'\n", fstab_device);
-            return fstab_device;
+            return &found;
         }
         free(pathbuf);
     }
 
-    /* just for safety */
-    if(mntpt)
-        *mntpt = 0;
-
     endmntent(f);
     free(pathbuf_arg);
     debug(" -> not found\n");
     return NULL;
 }
 
+const char *
+fstab_has_device(const char *fname, const char *device, char *mntpt, int *uid)
+{
+    const struct mntent *entry = fstab_find_device(fname, device);
+
+    if(!entry) {
+        /* just for safety */
+        if(mntpt)
+            *mntpt = 0;
+        return NULL;
+    }
+
+    if(mntpt)
+        snprintf(mntpt, MEDIA_STRING_SIZE - 1, "%s", entry->mnt_dir);
+    if(uid) {
+        char *uidopt = hasmntopt(entry, "uid");
+        if(uidopt)
+            uidopt = strchr(uidopt, '=');
+        if(uidopt) {
+            ++uidopt; /* skip the '=' */
+            /* FIXME: this probably needs more checking */
+            *uid = atoi(uidopt);
+        } else
+            *uid = -1;
+    }
+    return entry->mnt_fsname;
+}
+
 int
 fstab_has_mntpt(const char *fname, const char *mntpt, char **device)
 {
@@ -482,7 +505,8 @@ fstab_has_mntpt(const char *fname, const char *mntpt, char **device)
     char *realmntptbuf;
     const char *realmntpt, *fstabmntpt;
     int rc = 0;
-    *device = NULL;
+    if(device)
+        *device = NULL;
 
     /* resolve symlinks, if possible */
     if((realmntptbuf = realpath(mntpt, NULL)))
@@ -552,18 +576,14 @@ const char *hotplug_buses[] = {
     "usb", "ieee1394", "mmc", "pcmcia", "firewire", NULL,
 };
 
-/* The silent version of the device_removable function. */
+/**
+ * Check whether the drive of device, whose sysfs directory is
+ * blockdevpath, is removable.
+ */
 static int
-device_removable_silent(const char *device)
+blockdev_removable(const char *blockdevpath, const char *device)
 {
     int removable;
-    char *blockdevpath;
-
-    if(!find_sysfs_device(device, &blockdevpath)) {
-        debug("device_removable: could not find a sysfs device for %s\n",
-              device);
-        return 0;
-    }
 
     debug("device_removable: corresponding block device for %s is %s\n", device,
           blockdevpath);
@@ -585,10 +605,36 @@ device_removable_silent(const char *device)
         } else
             debug("Device %s does not belong to any allowlisted bus\n", device);
     }
+    return removable;
+}
+
+int
+device_removable_silent(const char *device)
+{
+    int removable;
+    char *blockdevpath;
+
+    if(!find_sysfs_device(device, &blockdevpath)) {
+        debug("device_removable: could not find a sysfs device for %s\n",
+              device);
+        return 0;
+    }
+    removable = blockdev_removable(blockdevpath, device);
     free(blockdevpath);
     return removable;
 }
 
+int
+device_handle_removable(const struct device_handle *dev)
+{
+    int removable = dev->sysdir && blockdev_removable(dev->sysdir, dev->path);
+
+    if(!removable)
+        fprintf(stderr, _("Error: device %s is not removable\n"), dev->path);
+
+    return removable;
+}
+
 int
 device_removable(const char *device)
 {
@@ -699,7 +745,7 @@ mntpt_valid(const char *mntpt)
     } else {
         int fd = assert_dir(mntpt, 1);
         if(fd >= 0) {
-            rc = assert_emptydir(fd);
+            rc = assert_emptydir(fd) == 0;
             close(fd);
         }
     }
@@ -707,6 +753,34 @@ mntpt_valid(const char *mntpt)
     return rc;
 }
 
+int
+mntpt_would_be_valid(const char *mntpt)
+{
+    char *fstab_device;
+    int fd, rc;
+
+    if(fstab_has_mntpt("/etc/fstab", mntpt, &fstab_device)) {
+        fprintf(stderr,
+                _("Error: mount point %s is already in /etc/fstab, "
+                  "associated to device %s\n"),
+                mntpt, fstab_device);
+        free(fstab_device);
+        return 0;
+    }
+
+    fd = open(mntpt, O_DIRECTORY | O_RDONLY);
+    if(fd < 0) {
+        if(errno == ENOENT)
+            return 1;
+        fprintf(stderr, _("Error: could not open directory %s: %s\n"), mntpt,
+                strerror(errno));
+        return 0;
+    }
+    rc = assert_emptydir(fd) == 0;
+    close(fd);
+    return rc;
+}
+
 int
 mntpt_mounted(const char *mntpt, int expect)
 {
@@ -818,3 +892,117 @@ ensure_user_physically_logged_in(const char *progname)
             progname);
     exit(E_DISALLOWED);
 }
+
+/**
+ * Identify the mount at mntpt: its mount ID when the kernel tells it (Linux
+ * 5.8), which is never the same for two mounts, or else its device.
+ * @return 0 on success, -1 if mntpt cannot be looked up
+ */
+static int
+mount_key(const char *mntpt, unsigned long long *key)
+{
+#ifdef STATX_MNT_ID
+    struct statx stx;
+
+    if(statx(AT_FDCWD, mntpt, AT_NO_AUTOMOUNT, STATX_MNT_ID, &stx))
+        return -1;
+    if(stx.stx_mask & STATX_MNT_ID)
+        *key = stx.stx_mnt_id;
+    else
+        *key = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+#else
+    struct stat st;
+
+    if(stat(mntpt, &st))
+        return -1;
+    *key = st.st_dev;
+#endif
+    return 0;
+}
+
+/**
+ * The path of the record of mntpt in dir (to be freed), or NULL if mntpt
+ * cannot be resolved.
+ */
+static char *
+mount_owner_path(const char *dir, const char *mntpt)
+{
+    char *real = realpath(mntpt, NULL), *path;
+
+    if(!real)
+        return NULL;
+    path = make_lock_path(dir, real);
+    free(real);
+    return path;
+}
+
+int
+mount_owner_record(const char *dir, const char *mntpt, uid_t uid)
+{
+    unsigned long long key;
+    char *path, line[64];
+    int fd, len, rc = -1;
+
+    if(mount_key(mntpt, &key) || !(path = mount_owner_path(dir, mntpt))) {
+        fprintf(stderr, "%s: %s\n", mntpt, strerror(errno));
+        return -1;
+    }
+    len = snprintf(line, sizeof(line), "%u %llu\n", (unsigned)uid, key);
+    get_root();
+    if(mkdir(dir, 0700) && errno != EEXIST)
+        fd = -1;
+    else
+        fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC,
+                  0600);
+    if(fd >= 0) {
+        if(write(fd, line, len) == len)
+            rc = 0;
+        close(fd);
+    }
+    if(rc)
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    drop_root();
+    free(path);
+    return rc;
+}
+
+int
+mount_owner_check(const char *dir, const char *mntpt, uid_t uid)
+{
+    unsigned long long key, recorded_key;
+    unsigned recorded_uid;
+    char *path;
+    int rc = 0;
+    FILE *f;
+
+    if(mount_key(mntpt, &key) || !(path = mount_owner_path(dir, mntpt)))
+        return 0;
+    get_root();
+    f = fopen(path, "re");
+    drop_root();
+    if(f) {
+        rc = fscanf(f, "%u %llu", &recorded_uid, &recorded_key) == 2 &&
+             recorded_uid == uid && recorded_key == key;
+        fclose(f);
+    }
+    debug("%s: %s\n", mntpt,
+          !f   ? "pmount did not record who mounted it"
+          : rc ? "mounted by pmount for the calling user"
+               : "mounted for someone else, or again since");
+    free(path);
+    return rc;
+}
+
+void
+mount_owner_forget(const char *dir, const char *mntpt)
+{
+    char *path = mount_owner_path(dir, mntpt);
+
+    if(!path)
+        return;
+    get_root();
+    if(unlink(path) && errno != ENOENT)
+        debug("unlink(%s): %s\n", path, strerror(errno));
+    drop_root();
+    free(path);
+}
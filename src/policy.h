@@ -12,13 +12,28 @@
 #define __policy_h
 
 #include "config.h"
+#include <mntent.h>
 #include <stdlib.h> /* for size_t */
+#include <sys/types.h>
+
+#include "device.h"
 
 #define MAX_LABEL_SIZE 255
 #define DEVDIR "/dev/"
 
 #define MEDIA_STRING_SIZE MAX_LABEL_SIZE + sizeof(MEDIADIR)
 
+/**
+ * Look for a device in a fstab-type file (fstab, /etc/mtab or
+ * /proc/mounts). Exits the program if file could not be opened.
+ * @param fname file of the fstab-type file to check
+ * @param device device name to scan for
+ * @return the first entry whose device has the same realpath() as device,
+ * overwritten by the next call (of this function or fstab_has_device()),
+ * or NULL if not found
+ */
+const struct mntent *fstab_find_device(const char *fname, const char *device);
+
 /**
  * Check whether a fstab-type file (fstab, /etc/mtab or /proc/mounts)
  * contains a device. Exits the program if file could not be opened.
@@ -68,6 +83,17 @@ extern const char *hotplug_buses[];
  */
 int device_removable(const char *device);
 
+/**
+ * The silent version of device_removable().
+ */
+int device_removable_silent(const char *device);
+
+/**
+ * Same as device_removable(), for an opened device: its sysfs directory
+ * is not looked up again.
+ */
+int device_handle_removable(const struct device_handle *dev);
+
 /**
  * Check whether device is allowlisted in /etc/pmount.allow
  */
@@ -84,6 +110,12 @@ int device_locked(const char *device);
  */
 int mntpt_valid(const char *mntpt);
 
+/**
+ * Same checks as mntpt_valid(), without creating anything: a missing mount
+ * point is fine, as mntpt_valid() would create it.
+ */
+int mntpt_would_be_valid(const char *mntpt);
+
 /**
  * Check if something is mounted at mount point.
  * @param mntpt mount point path
@@ -106,6 +138,29 @@ int is_blockdev_attr_true(const char *blockdevpath, const char *attr);
 
 const char *bus_has_ancestry(const char *blockdevpath, const char **buses);
 
+/** Where mount_owner_record() keeps its records */
+#define MOUNT_OWNER_DIR LOCKDIR "/.owners"
+
+/**
+ * Record in dir that the file system mounted at mntpt was mounted by pmount
+ * for uid. The record names that very mount, not only its mount point: a
+ * later mount on the same directory does not inherit it.
+ * @return 0 on success, -1 on error (message is printed in this case)
+ */
+int mount_owner_record(const char *dir, const char *mntpt, uid_t uid);
+
+/**
+ * Check the record of mntpt in dir.
+ * @return 1 if the file system mounted at mntpt is the one pmount mounted
+ * for uid, 0 otherwise (no record, another user, or another mount since)
+ */
+int mount_owner_check(const char *dir, const char *mntpt, uid_t uid);
+
+/**
+ * Forget the record of mntpt in dir, if there is one.
+ */
+void mount_owner_forget(const char *dir, const char *mntpt);
+
 /**
    Checks if the user is physically logged in or allowed anyway, and
    exit if that isn't the case.
@@ -0,0 +1,519 @@
+/**
+ * probe.c -- batched probing of the headers of block devices
+ *
+ * This software is distributed under the terms and conditions of the
+ * GNU General Public License. See file GPL for the full text of the license.
+ */
+
+#define _GNU_SOURCE
+#include "config.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include "probe.h"
+#include "utils.h"
+
+/* PROBE_READ_SIZE is a multiple of it */
+#define PROBE_ALIGN 4096
+
+/* Reads in flight at once, and size of the buffer pool */
+#define PROBE_DEPTH 32
+
+#define PROBE_THREADS_MAX 8
+
+static unsigned int
+le16(const unsigned char *p)
+{
+    return p[0] | p[1] << 8;
+}
+
+static uint32_t
+le32(const unsigned char *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/** Whether buf holds the len bytes of magic at offset */
+static int
+has_magic(const unsigned char *buf, size_t len, size_t offset,
+          const char *magic, size_t size)
+{
+    return offset + size <= len && !memcmp(buf + offset, magic, size);
+}
+
+#define MAGIC(offset, magic)                                                   \
+    has_magic(buf, len, offset, magic, sizeof(magic) - 1)
+
+static const char *
+probe_classify_ext(const unsigned char *sb)
+{
+    uint32_t compat = le32(sb + 0x5c);
+    uint32_t incompat = le32(sb + 0x60);
+    uint32_t ro_compat = le32(sb + 0x64);
+
+    /* features ext3 does not know of: extents, 64bit, flex_bg... */
+    if(incompat & ~(0x0002 | 0x0004 | 0x0010) ||
+       ro_compat & ~(0x0001 | 0x0002 | 0x0004))
+        return "ext4";
+    /* has_journal */
+    if(compat & 0x0004)
+        return "ext3";
+    return "ext2";
+}
+
+const char *
+probe_classify(const unsigned char *buf, size_t len)
+{
+    if(MAGIC(0, "LUKS\xba\xbe"))
+        return "crypto_LUKS";
+    if(MAGIC(0, "XFSB"))
+        return "xfs";
+    if(MAGIC(0, "hsqs"))
+        return "squashfs";
+    if(MAGIC(3, "EXFAT   "))
+        return "exfat";
+    if(MAGIC(3, "NTFS    "))
+        return "ntfs";
+    if(MAGIC(0x110, "\xc2\x99\x3d\x87"))
+        return "omfs";
+    if(len >= 512 && (buf[0] == 0xeb || buf[0] == 0xe9) &&
+       (MAGIC(0x52, "FAT32") || MAGIC(0x36, "FAT")))
+        return "vfat";
+
+    if(len >= 2048) {
+        const unsigned char *sb = buf + 1024;
+
+        /* an HFS wrapper around an HFS+ volume counts as HFS+ */
+        if(MAGIC(1024, "H+") || MAGIC(1024, "HX") ||
+           (MAGIC(1024, "BD") && MAGIC(1024 + 0x7c, "H+")))
+            return "hfsplus";
+        if(MAGIC(1024, "BD"))
+            return "hfs";
+        if(le16(sb + 0x38) == 0xef53)
+            return probe_classify_ext(sb);
+        if(le32(sb) == 0xe0f5e1e2)
+            return "erofs";
+        if(le32(sb) == 0xf2f52010)
+            return "f2fs";
+        if(le16(sb + 6) == 0x3434)
+            return "nilfs2";
+    }
+    if(MAGIC(0x10040, "_BHRfS_M"))
+        return "btrfs";
+    if(MAGIC(0x10034, "ReIsErFs") || MAGIC(0x10034, "ReIsEr2Fs") ||
+       MAGIC(0x10034, "ReIsEr3Fs") || MAGIC(0x2034, "ReIsErFs"))
+        return "reiserfs";
+    if(MAGIC(0x10000, "ReIsEr4"))
+        return "reiser4";
+    if(MAGIC(0x8000, "JFS1"))
+        return "jfs";
+
+    /* the volume descriptors of optical media, one per 2 KiB sector */
+    for(size_t off = 0x8001; off + 5 <= len && off < 0x8001 + 16 * 2048;
+        off += 2048)
+        if(MAGIC(off, "NSR02") || MAGIC(off, "NSR03"))
+            return "udf";
+    if(MAGIC(0x8001, "CD001"))
+        return "iso9660";
+
+    if(MAGIC(512, "EFI PART"))
+        return "gpt";
+    if(len >= 512 && buf[510] == 0x55 && buf[511] == 0xaa)
+        return "dos";
+    return NULL;
+}
+
+/**
+   Opens device for probing, as root.
+
+   @return a descriptor, or -1 (and errno is set)
+ */
+static int
+probe_open(const char *device)
+{
+    struct stat st;
+    int fd;
+
+    get_root();
+    fd = open(device, O_RDONLY | O_DIRECT | O_CLOEXEC);
+    if(fd < 0 && errno == EINVAL)
+        fd = open(device, O_RDONLY | O_CLOEXEC);
+    drop_root();
+    if(fd < 0)
+        return -1;
+
+    /* only devices are read as root */
+    if(fstat(fd, &st) || !S_ISBLK(st.st_mode)) {
+        close(fd);
+        errno = ENOTBLK;
+        return -1;
+    }
+    return fd;
+}
+
+static void
+probe_done(struct probe_result *result, const unsigned char *buf,
+           ssize_t size)
+{
+    if(size < 0) {
+        result->error = -size;
+        debug("probe: %s: %s\n", result->device, strerror(result->error));
+        return;
+    }
+    result->type = probe_classify(buf, size);
+    debug("probe: %s: %s\n", result->device,
+          result->type ? result->type : "unknown");
+}
+
+/** Reads the header of fd with pread(), and classifies it */
+static void
+probe_read(struct probe_result *result, int fd, unsigned char *buf)
+{
+    ssize_t size = pread(fd, buf, PROBE_READ_SIZE, 0);
+
+    probe_done(result, buf, size < 0 ? -errno : size);
+}
+
+static unsigned char *
+probe_alloc(size_t count)
+{
+    unsigned char *pool = aligned_alloc(PROBE_ALIGN, count * PROBE_READ_SIZE);
+
+    if(!pool) {
+        perror("aligned_alloc");
+        exit(E_INTERNAL);
+    }
+    return pool;
+}
+
+/** The devices shared by the threads of the pool */
+struct probe_batch {
+    struct probe_result *results;
+    const int *fds;
+    size_t n;
+    size_t next; /* next device to read, taken atomically */
+};
+
+/** One thread of the pool, with its buffer */
+struct probe_worker {
+    pthread_t thread;
+    struct probe_batch *batch;
+    unsigned char *buf;
+};
+
+static void *
+probe_worker_run(void *arg)
+{
+    struct probe_worker *worker = arg;
+    struct probe_batch *batch = worker->batch;
+    size_t i;
+
+    while((i = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED)) <
+          batch->n)
+        if(batch->fds[i] >= 0)
+            probe_read(&batch->results[i], batch->fds[i], worker->buf);
+    return NULL;
+}
+
+/**
+   Reads the headers with a pool of threads (or with the calling thread
+   alone if count is 1), each taking the next device until there are
+   none left.
+ */
+static void
+probe_with_threads(struct probe_result *results, const int *fds, size_t n,
+                   size_t count)
+{
+    struct probe_batch batch = {
+        .results = results, .fds = fds, .n = n, .next = 0
+    };
+    struct probe_worker workers[PROBE_THREADS_MAX];
+    unsigned char *pool;
+    size_t started = 0;
+
+    if(count > PROBE_THREADS_MAX)
+        count = PROBE_THREADS_MAX;
+    if(count > n)
+        count = n;
+    if(!count)
+        return;
+    pool = probe_alloc(count);
+
+    for(size_t t = 0; t < count; t++) {
+        workers[t].batch = &batch;
+        workers[t].buf = pool + t * PROBE_READ_SIZE;
+    }
+    /* the calling thread is the first worker */
+    for(size_t t = 1; t < count; t++) {
+        if(pthread_create(&workers[t].thread, NULL, probe_worker_run,
+                          &workers[t])) {
+            debug("probe: could only start %zu threads\n", t - 1);
+            break;
+        }
+        started = t;
+    }
+    probe_worker_run(&workers[0]);
+    for(size_t t = 1; t <= started; t++)
+        pthread_join(workers[t].thread, NULL);
+    free(pool);
+}
+
+#if HAVE_IO_URING
+
+/** The rings shared with the kernel */
+struct probe_ring {
+    int fd;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+};
+
+static void
+probe_ring_exit(struct probe_ring *ring)
+{
+    if(ring->sqes && ring->sqes != MAP_FAILED)
+        munmap(ring->sqes, ring->sqes_size);
+    if(ring->cq_ring && ring->cq_ring != MAP_FAILED &&
+       ring->cq_ring != ring->sq_ring)
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    if(ring->sq_ring && ring->sq_ring != MAP_FAILED)
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+}
+
+/**
+   Sets up an io_uring instance with room for entries requests.
+
+   @return 0 on success, -1 if io_uring is not available
+ */
+static int
+probe_ring_init(struct probe_ring *ring, unsigned entries)
+{
+    struct io_uring_params p;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&p, 0, sizeof(p));
+    ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if(ring->fd < 0) {
+        debug("probe: io_uring_setup: %s\n", strerror(errno));
+        return -1;
+    }
+
+    ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size =
+        p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if(p.features & IORING_FEAT_SINGLE_MMAP) {
+        if(ring->cq_ring_size > ring->sq_ring_size)
+            ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring->fd,
+                         IORING_OFF_SQ_RING);
+    if(ring->sq_ring == MAP_FAILED)
+        goto error;
+    if(p.features & IORING_FEAT_SINGLE_MMAP)
+        ring->cq_ring = ring->sq_ring;
+    else {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, ring->fd,
+                             IORING_OFF_CQ_RING);
+        if(ring->cq_ring == MAP_FAILED)
+            goto error;
+    }
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if(ring->sqes == MAP_FAILED)
+        goto error;
+
+    ring->sq_tail = (unsigned *)((char *)ring->sq_ring + p.sq_off.tail);
+    ring->sq_mask = (unsigned *)((char *)ring->sq_ring + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)((char *)ring->sq_ring + p.sq_off.array);
+    ring->cq_head = (unsigned *)((char *)ring->cq_ring + p.cq_off.head);
+    ring->cq_tail = (unsigned *)((char *)ring->cq_ring + p.cq_off.tail);
+    ring->cq_mask = (unsigned *)((char *)ring->cq_ring + p.cq_off.ring_mask);
+    ring->cqes =
+        (struct io_uring_cqe *)((char *)ring->cq_ring + p.cq_off.cqes);
+    return 0;
+
+error:
+    debug("probe: could not map the io_uring rings: %s\n", strerror(errno));
+    probe_ring_exit(ring);
+    return -1;
+}
+
+/** Queues a read of the header of fd into iov, tagged with data */
+static void
+probe_ring_queue(struct probe_ring *ring, int fd, const struct iovec *iov,
+                 uint64_t data)
+{
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    /* READV rather than READ, which needs Linux 5.6 */
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t)iov;
+    sqe->len = 1;
+    sqe->off = 0;
+    sqe->user_data = data;
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/**
+   Reads the headers through io_uring: as many reads as there are
+   buffers in the pool are submitted at once, and each completion
+   classifies its device and makes room for the next read.
+
+   @return 0 on success, -1 if io_uring is not available (nothing has
+   been read then)
+ */
+static int
+probe_with_uring(struct probe_result *results, const int *fds, size_t n)
+{
+    struct probe_ring ring;
+    struct iovec iov[PROBE_DEPTH];
+    size_t free_slots[PROBE_DEPTH], nb_free, depth;
+    size_t next = 0, pending = 0;
+    unsigned char *pool;
+    unsigned queued = 0;
+
+    depth = n < PROBE_DEPTH ? n : PROBE_DEPTH;
+    if(!depth)
+        return 0;
+    if(probe_ring_init(&ring, depth))
+        return -1;
+
+    pool = probe_alloc(depth);
+    for(size_t s = 0; s < depth; s++) {
+        iov[s].iov_base = pool + s * PROBE_READ_SIZE;
+        iov[s].iov_len = PROBE_READ_SIZE;
+        free_slots[s] = s;
+    }
+    nb_free = depth;
+
+    while(next < n || pending) {
+        unsigned head, tail;
+        int rc;
+
+        for(; next < n && nb_free; next++) {
+            if(fds[next] < 0)
+                continue;
+            size_t slot = free_slots[--nb_free];
+            probe_ring_queue(&ring, fds[next], &iov[slot],
+                             (uint64_t)next << 8 | slot);
+            queued++;
+            pending++;
+        }
+        if(!pending)
+            break;
+
+        rc = syscall(__NR_io_uring_enter, ring.fd, queued, 1,
+                     IORING_ENTER_GETEVENTS, NULL, 0);
+        if(rc < 0) {
+            if(errno == EINTR || errno == EAGAIN || errno == EBUSY)
+                continue;
+            debug("probe: io_uring_enter: %s\n", strerror(errno));
+            break;
+        }
+        queued -= rc;
+
+        head = *ring.cq_head;
+        tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+        for(; head != tail; head++) {
+            struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+            size_t i = cqe->user_data >> 8, slot = cqe->user_data & 0xff;
+
+            if(cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP)
+                /* READV not supported, or O_DIRECT refused */
+                probe_read(&results[i], fds[i], iov[slot].iov_base);
+            else
+                probe_done(&results[i], iov[slot].iov_base, cqe->res);
+            free_slots[nb_free++] = slot;
+            pending--;
+        }
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    probe_ring_exit(&ring);
+    if(pending || next < n)
+        /* the kernel may still write into the pool: it is not freed, and
+           the caller reads everything again */
+        return -1;
+    free(pool);
+    return 0;
+}
+
+#endif /* HAVE_IO_URING */
+
+enum probe_engine
+probe_devices(struct probe_result *results, size_t n, enum probe_engine engine)
+{
+    int *fds = malloc(n * sizeof(int));
+
+    if(n && !fds) {
+        perror("malloc");
+        exit(E_INTERNAL);
+    }
+
+    /* opened here rather than in the threads, as root privileges are
+       process-wide */
+    for(size_t i = 0; i < n; i++) {
+        results[i].type = NULL;
+        results[i].error = 0;
+        fds[i] = probe_open(results[i].device);
+        if(fds[i] < 0) {
+            results[i].error = errno;
+            debug("probe: %s: %s\n", results[i].device, strerror(errno));
+        }
+    }
+
+    /* nothing to overlap */
+    if(engine == PROBE_AUTO && n <= 1)
+        engine = PROBE_SEQUENTIAL;
+#if HAVE_IO_URING
+    if(engine == PROBE_AUTO || engine == PROBE_URING) {
+        if(!probe_with_uring(results, fds, n))
+            engine = PROBE_URING;
+        else {
+            debug("probe: io_uring unusable, using threads\n");
+            engine = PROBE_THREADS;
+        }
+    }
+#else
+    if(engine == PROBE_AUTO || engine == PROBE_URING)
+        engine = PROBE_THREADS;
+#endif
+    if(engine == PROBE_THREADS)
+        probe_with_threads(results, fds, n, PROBE_THREADS_MAX);
+    else if(engine == PROBE_SEQUENTIAL)
+        probe_with_threads(results, fds, n, 1);
+
+    for(size_t i = 0; i < n; i++)
+        if(fds[i] >= 0)
+            close(fds[i]);
+    free(fds);
+    return engine;
+}
@@ -0,0 +1,52 @@
+/**
+ * @file probe.h - batched probing of the headers of block devices
+ *
+ * This software is distributed under the terms and conditions of the
+ * GNU General Public License. See file GPL for the full text of the license.
+ */
+
+#ifndef __probe_h
+#define __probe_h
+
+#include <stddef.h>
+
+/* What probe_classify() needs to see of a device: enough for every magic
+   it knows, the furthest being the btrfs one at 64 KiB */
+#define PROBE_READ_SIZE (68 * 1024)
+
+/** How the headers are read */
+enum probe_engine {
+    PROBE_AUTO,       /* io_uring (or the thread pool if unavailable) for
+                         several devices, pread() for one */
+    PROBE_URING,      /* all the reads submitted at once to io_uring */
+    PROBE_THREADS,    /* a pool of threads doing pread() */
+    PROBE_SEQUENTIAL, /* one pread() after the other */
+};
+
+/** The outcome of probing one device */
+struct probe_result {
+    const char *device; /* set by the caller */
+    const char *type;   /* as named by blkid, NULL if not recognized */
+    int error;          /* errno if the device could not be read, or 0 */
+};
+
+/**
+   Classifies a device from its first bytes: file systems, LUKS and
+   partition tables, by their magic numbers.
+
+   @return the type, as blkid names it (vfat, crypto_LUKS, gpt...), or
+   NULL if the header is not recognized
+ */
+const char *probe_classify(const unsigned char *buf, size_t len);
+
+/**
+   Reads the headers of the n devices of results (as root, with
+   O_DIRECT when possible) and classifies them, filling in the type
+   and error fields. Only block devices are read.
+
+   @return the engine that was actually used
+ */
+enum probe_engine probe_devices(struct probe_result *results, size_t n,
+                                enum probe_engine engine);
+
+#endif
@@ -11,26 +11,39 @@
 
 #define _GNU_SOURCE
 #include "config.h"
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <libintl.h>
 #include <limits.h>
-#include <locale.h>
+#include <linux/fs.h>
+#include <mntent.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
 #include "configuration.h"
+#include "iostat.h"
 #include "luks.h"
+#include "metrics.h"
+#include "overlay.h"
 #include "policy.h"
+#include "recorder.h"
 #include "utils.h"
 
 extern const char *VERSION;
 
 static char mntpt[MEDIA_STRING_SIZE];
 
+/* what pmount maps /dev/X to, followed by dev_X */
+#define LUKS_MAPPER_PREFIX "/dev/mapper/_"
+
 /**
  * Print some help.
  * @param exename Name of the executable (argv[0]).
@@ -44,18 +57,34 @@ usage(const char *exename)
           "  are met (see pumount(1) for details). The mount point directory "
           "is removed\n"
           "  afterwards.\n\n"
+          "%s --reap-vanished\n"
+          "  Lazily unmount what pmount mounted from devices that are gone, "
+          "and clean up\n"
+          "  after them: LUKS mappings, loop devices, mount points and "
+          "locks.\n\n"
           "Options:\n"
           "  -l, --lazy   : umount lazily, see umount(8)\n"
+          "  -t, --trim   : discard the unused blocks of flash media before "
+          "unmounting\n"
+          "  --no-trim    : do not, even if pmount.conf asks for it\n"
+          "  --idempotent : succeed if <device> is not mounted\n"
           "  -d, --debug  : enable debug output (very verbose)\n"
           "  -h, --help   : print help message and exit successfully\n"
           "  --version    : print version number and exit successfully\n"),
-        exename, MEDIADIR);
+        exename, MEDIADIR, exename);
 }
 
 static struct {
     bool lazy;
+    /* set by getopt_long() as ints */
+    int reap;
+    int idempotent;
+    enum { TRIM_DEFAULT, TRIM_YES, TRIM_NO } trim;
 } options = {
     .lazy = false,
+    .reap = false,
+    .idempotent = false,
+    .trim = TRIM_DEFAULT,
 };
 
 /**
@@ -102,6 +131,22 @@ check_umount_policy(const char *device, int ok_if_inexistant)
     return 0;
 }
 
+/**
+ * With --idempotent, a device that is not mounted (or does not even
+ * exist) is what was asked for.
+ * @return 1 if there is nothing to do, 0 otherwise
+ */
+static int
+already_unmounted(const char *device)
+{
+    if(!options.idempotent ||
+       fstab_has_device("/etc/mtab", device, NULL, NULL) ||
+       fstab_has_device("/proc/mounts", device, NULL, NULL))
+        return 0;
+    debug("%s is not mounted, nothing to do\n", device);
+    return 1;
+}
+
 /**
  * Drop all privileges and exec 'umount device'. Does not return on success, if
  * it returns, UMOUNTPROG could not be executed.
@@ -139,6 +184,21 @@ do_umount(const char *device)
 {
     int status;
 
+    /* the overlay of pmount --overlay goes first, then what is below */
+    if(overlay_mounted(mntpt)) {
+        debug("unmounting the overlay on %s\n", mntpt);
+        if(options.lazy)
+            status = spawnl(SPAWN_EROOT | SPAWN_RROOT, UMOUNTPROG, UMOUNTPROG,
+                            "-l", mntpt, (char *)NULL);
+        else
+            status = spawnl(SPAWN_EROOT | SPAWN_RROOT, UMOUNTPROG, UMOUNTPROG,
+                            mntpt, (char *)NULL);
+        if(status != 0) {
+            fputs(_("Error: umount failed\n"), stderr);
+            return -1;
+        }
+    }
+
     if(options.lazy)
         status = spawnl(SPAWN_EROOT | SPAWN_RROOT, UMOUNTPROG, UMOUNTPROG, "-d",
                         "-l", device, (char *)NULL);
@@ -154,6 +214,658 @@ do_umount(const char *device)
     return 0;
 }
 
+/**
+ * Read a number from a sysfs attribute of blockdevpath.
+ * @return the number, or 0 if it cannot be read
+ */
+static unsigned long long
+blockdev_attr_ull(const char *blockdevpath, const char *attr)
+{
+    unsigned long long value = 0;
+    char *path;
+    FILE *f;
+
+    if(asprintf(&path, "%s/%s", blockdevpath, attr) == -1) {
+        perror("asprintf");
+        exit(E_INTERNAL);
+    }
+    if((f = fopen(path, "r"))) {
+        if(fscanf(f, "%llu", &value) != 1)
+            value = 0;
+        fclose(f);
+    }
+    free(path);
+    return value;
+}
+
+/**
+ * Whether pmount.conf asks for device to be trimmed: it is on one of the
+ * trim_buses.
+ */
+static int
+trim_by_default(const char *blockdevpath)
+{
+    char **buses = conffile_trim_buses();
+
+    if(!buses)
+        return 0;
+    for(char **b = buses; *b; b++)
+        if(!strcmp(*b, "all"))
+            return 1;
+    return bus_has_ancestry(blockdevpath, (const char **)buses) != NULL;
+}
+
+/**
+ * Tell the device which blocks of the file system mounted on mntpt are
+ * unused (FITRIM), if --trim or pmount.conf ask for it and the device
+ * accepts discards, and report how much was trimmed.
+ */
+static void
+do_trim(const char *device)
+{
+    struct fstrim_range range = { .start = 0, .len = ULLONG_MAX, .minlen = 0 };
+    struct timespec start;
+    char *sysdir;
+    int fd, rc, saved_errno, wanted;
+
+    /* below an overlay, the device is mounted read-only */
+    if(options.trim == TRIM_NO || !is_block(device) ||
+       overlay_mounted(mntpt) || !find_sysfs_device(device, &sysdir))
+        return;
+
+    wanted = options.trim == TRIM_YES || trim_by_default(sysdir);
+    if(!wanted) {
+        free(sysdir);
+        return;
+    }
+    /* discards from dm-crypt only get through with allow_discards, in
+       which case its queue says so */
+    if(!blockdev_attr_ull(sysdir, "queue/discard_max_bytes")) {
+        if(options.trim == TRIM_YES)
+            fprintf(stderr,
+                    _("Warning: %s does not support discard, not "
+                      "trimming\n"),
+                    device);
+        else
+            debug("%s does not support discard, not trimming\n", device);
+        free(sysdir);
+        return;
+    }
+    free(sysdir);
+
+    recorder_phase("trim");
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    get_root();
+    fd = open(mntpt, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    rc = fd < 0 ? -1 : ioctl(fd, FITRIM, &range);
+    saved_errno = errno;
+    if(fd >= 0)
+        close(fd);
+    drop_root();
+
+    if(rc) {
+        recorder_error("FITRIM");
+        fprintf(stderr, _("Warning: could not trim %s: %s\n"), mntpt,
+                strerror(saved_errno));
+        return;
+    }
+    /* range.len is now the number of bytes trimmed */
+    fprintf(stderr, _("%s: trimmed %.1f MiB in %.2f s\n"), device,
+            range.len / (1024.0 * 1024.0), metrics_since(&start));
+}
+
+/**
+ * Count the unmount for the file system type device is mounted with.
+ */
+static void
+set_metrics_fstype(const char *device)
+{
+    struct mntent *ent;
+    FILE *f;
+
+    if(!(f = setmntent("/proc/mounts", "r")))
+        return;
+    while((ent = getmntent(f)))
+        if(!strcmp(ent->mnt_fsname, device)) {
+            metrics_set_fstype(ent->mnt_type);
+            break;
+        }
+    endmntent(f);
+}
+
+/**
+ * Return the amount of memory used by the page cache, in KiB, or -1.
+ */
+static long
+page_cache_kb(void)
+{
+    FILE *f;
+    char line[128];
+    long kb, total = 0;
+
+    if(!(f = fopen("/proc/meminfo", "r")))
+        return -1;
+    while(fgets(line, sizeof(line), f))
+        if(sscanf(line, "Buffers: %ld kB", &kb) == 1 ||
+           sscanf(line, "Cached: %ld kB", &kb) == 1)
+            total += kb;
+    fclose(f);
+    return total;
+}
+
+/**
+ * Find what keeps the data of device in the page cache once it is
+ * unmounted: the device itself, or the device below it for a dm-crypt
+ * mapping (which goes away with luksClose), and the backing file of the
+ * latter if it is a loop device. This must be called before unmounting,
+ * as umount -d detaches loop devices.
+ * @param blockdev set to the block device (must be freed)
+ * @param backing set to the backing file, or NULL (must be freed)
+ * @return 0 on success, -1 if device could not be found in sysfs
+ */
+static int
+find_cached_objects(const char *device, char **blockdev, char **backing)
+{
+    char *sysdir, *path;
+    char buf[PATH_MAX];
+    struct dirent *slave;
+    DIR *slaves;
+    FILE *f;
+
+    *blockdev = *backing = NULL;
+    if(!is_block(device) || !find_sysfs_device(device, &sysdir))
+        return -1;
+
+    /* dm devices list the devices they are built upon as slaves */
+    if(asprintf(&path, "%s/slaves", sysdir) == -1) {
+        perror("asprintf");
+        exit(E_INTERNAL);
+    }
+    if((slaves = opendir(path))) {
+        while(!*blockdev && (slave = readdir(slaves)))
+            if(slave->d_name[0] != '.' &&
+               asprintf(blockdev, DEVDIR "%s", slave->d_name) == -1) {
+                perror("asprintf");
+                exit(E_INTERNAL);
+            }
+        closedir(slaves);
+    }
+    free(path);
+
+    if(*blockdev) {
+        free(sysdir);
+        if(!is_block(*blockdev) || !find_sysfs_device(*blockdev, &sysdir)) {
+            free(*blockdev);
+            *blockdev = NULL;
+            return -1;
+        }
+    } else if(!(*blockdev = strdup(device))) {
+        perror("strdup(device)");
+        exit(E_INTERNAL);
+    }
+
+    if(asprintf(&path, "%s/loop/backing_file", sysdir) == -1) {
+        perror("asprintf");
+        exit(E_INTERNAL);
+    }
+    if((f = fopen(path, "r"))) {
+        if(fgets(buf, sizeof(buf), f)) {
+            buf[strcspn(buf, "\n")] = 0;
+            *backing = strdup(buf);
+        }
+        fclose(f);
+    }
+    free(path);
+    free(sysdir);
+
+    debug("page cache of %s held by %s%s%s\n", device, *blockdev,
+          *backing ? " and " : "", *backing ? *backing : "");
+    return 0;
+}
+
+/**
+ * Drop the page cache of an unmounted block device and of the backing file
+ * of loop devices (see find_cached_objects()).
+ */
+static void
+drop_page_cache(const char *blockdev, const char *backing)
+{
+    long before = enable_debug ? page_cache_kb() : -1, after;
+    int fd;
+
+    get_root();
+    fd = open(blockdev, O_RDONLY | O_CLOEXEC);
+    if(fd >= 0) {
+        if(ioctl(fd, BLKFLSBUF, 0))
+            debug("ioctl(%s, BLKFLSBUF): %s\n", blockdev, strerror(errno));
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    } else
+        debug("open(%s): %s\n", blockdev, strerror(errno));
+    drop_root();
+
+    /* the path of the backing file is the user's to choose: it is opened
+       with their rights, and only if it still is a regular file */
+    if(backing) {
+        struct stat st;
+
+        fd = open(backing, O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC);
+        if(fd < 0)
+            debug("open(%s): %s\n", backing, strerror(errno));
+        else if(fstat(fd, &st) || !S_ISREG(st.st_mode))
+            debug("%s is not a regular file, its cache is kept\n", backing);
+        else {
+            /* dirty pages cannot be dropped, write them back first */
+            fdatasync(fd);
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        }
+        if(fd >= 0)
+            close(fd);
+    }
+
+    if(before >= 0 && (after = page_cache_kb()) >= 0)
+        debug("dropped page cache: %ld KiB freed\n",
+              before > after ? before - after : 0);
+}
+
+/** A mount from the mount table snapshot of --reap-vanished */
+struct mount_entry {
+    dev_t dev;    /* as the kernel knows it, 0:N for virtual devices */
+    char *source; /* device node, as given to mount */
+    char *mntpt;
+};
+
+/**
+ * Decode in place the \\ooo escapes of a path in /proc/self/mountinfo.
+ */
+static void
+unescape_octal(char *s)
+{
+    char *d = s;
+
+    for(; *s; s++, d++) {
+        if(s[0] == '\\' && s[1] >= '0' && s[1] <= '3' && s[2] >= '0' &&
+           s[2] <= '7' && s[3] >= '0' && s[3] <= '7') {
+            *d = (s[1] - '0') * 64 + (s[2] - '0') * 8 + (s[3] - '0');
+            s += 3;
+        } else
+            *d = *s;
+    }
+    *d = 0;
+}
+
+/**
+ * Read the mounts of devices on a directory below mediadir from
+ * /proc/self/mountinfo, which unlike /proc/mounts has the device number
+ * each was mounted from.
+ * @return the number of mounts found, -1 if the table cannot be read
+ */
+static ssize_t
+read_media_mounts(const char *mediadir, struct mount_entry **mounts)
+{
+    size_t count = 0, len = strlen(mediadir), size = 0;
+    char *line = NULL;
+    FILE *f;
+
+    *mounts = NULL;
+    if(!(f = fopen("/proc/self/mountinfo", "r"))) {
+        perror(_("Error: could not read the mount table"));
+        return -1;
+    }
+    while(getline(&line, &size, f) > 0) {
+        char *mntpt = NULL, *source = NULL;
+        const char *sep = strstr(line, " - ");
+        unsigned maj, min;
+
+        if(sscanf(line, "%*u %*u %u:%u %*s %ms", &maj, &min, &mntpt) != 3 ||
+           !sep || sscanf(sep + 3, "%*s %ms", &source) != 1) {
+            free(mntpt);
+            continue;
+        }
+        unescape_octal(mntpt);
+        unescape_octal(source);
+        if(strncmp(mntpt, mediadir, len) || mntpt[len] != '/' ||
+           strncmp(source, DEVDIR, sizeof(DEVDIR) - 1)) {
+            free(mntpt);
+            free(source);
+            continue;
+        }
+        *mounts = realloc(*mounts, (count + 1) * sizeof(**mounts));
+        if(!*mounts) {
+            perror("realloc");
+            exit(E_INTERNAL);
+        }
+        (*mounts)[count].dev = makedev(maj, min);
+        (*mounts)[count].source = source;
+        (*mounts)[count].mntpt = mntpt;
+        count++;
+    }
+    free(line);
+    fclose(f);
+    return count;
+}
+
+/**
+ * Whether sysdir is that of a loop device whose image has been deleted.
+ */
+static int
+loop_image_deleted(const char *sysdir)
+{
+    static const char deleted[] = " (deleted)";
+    char *path, buf[PATH_MAX];
+    size_t len = 0;
+    FILE *f;
+
+    if(asprintf(&path, "%s/loop/backing_file", sysdir) == -1) {
+        perror("asprintf");
+        exit(E_INTERNAL);
+    }
+    if((f = fopen(path, "r"))) {
+        if(fgets(buf, sizeof(buf), f))
+            len = strcspn(buf, "\n");
+        fclose(f);
+    }
+    free(path);
+    return len >= sizeof(deleted) - 1 &&
+           !strncmp(buf + len - (sizeof(deleted) - 1), deleted,
+                    sizeof(deleted) - 1);
+}
+
+/**
+ * Check whether the block device of sysdir, or one of those a dm device
+ * is built upon, is gone.
+ * @return why it is gone, or NULL if it is still there
+ */
+static const char *
+sysfs_vanished(const char *sysdir)
+{
+    const char *reason = NULL;
+    struct dirent *slave;
+    DIR *slaves;
+    char *path;
+    int count = 0;
+
+    /* a loop device whose image was deleted still works: the kernel
+       keeps the file, and whoever mounted it may still be using it */
+    if(access(sysdir, F_OK))
+        return _("device removed");
+
+    /* a dm device holds on to the devices below it when they are
+       removed, but sysfs does not list them any longer */
+    if(asprintf(&path, "%s/dm", sysdir) == -1) {
+        perror("asprintf");
+        exit(E_INTERNAL);
+    }
+    if(access(path, F_OK)) {
+        free(path);
+        return NULL;
+    }
+    free(path);
+    if(asprintf(&path, "%s/slaves", sysdir) == -1) {
+        perror("asprintf");
+        exit(E_INTERNAL);
+    }
+    if((slaves = opendir(path))) {
+        while(!reason && (slave = readdir(slaves))) {
+            char *slavedir;
+
+            if(slave->d_name[0] == '.')
+                continue;
+            count++;
+            if(asprintf(&slavedir, "%s/%s", path, slave->d_name) == -1) {
+                perror("asprintf");
+                exit(E_INTERNAL);
+            }
+            reason = sysfs_vanished(slavedir);
+            free(slavedir);
+        }
+        closedir(slaves);
+    }
+    free(path);
+    return reason || count ? reason : _("device removed");
+}
+
+/**
+ * Check whether device is gone, or its node now names another device
+ * than the one (if not 0) that was mounted from it.
+ * @return why it is gone, or NULL if it is still there
+ */
+static const char *
+device_vanished(const char *device, dev_t mounted)
+{
+    const char *reason;
+    struct stat st;
+    char *sysdir;
+
+    if(stat(device, &st) || !S_ISBLK(st.st_mode))
+        return _("device removed");
+    if(mounted && major(mounted) && st.st_rdev != mounted)
+        return _("device node now names another device");
+
+    if(asprintf(&sysdir, "/sys/dev/block/%u:%u", major(st.st_rdev),
+                minor(st.st_rdev)) == -1) {
+        perror("asprintf");
+        exit(E_INTERNAL);
+    }
+    reason = sysfs_vanished(sysdir);
+    free(sysdir);
+    return reason;
+}
+
+/**
+ * Remove the lock directory of device, with the pid locks it holds: they
+ * are of no use once the device is gone.
+ */
+static void
+remove_lock_dir(const char *device)
+{
+    char *lockdirpath = make_lock_path(LOCKDIR, device);
+    struct dirent *lockfile;
+    DIR *lockdir;
+
+    get_root();
+    if((lockdir = opendir(lockdirpath))) {
+        while((lockfile = readdir(lockdir)))
+            if(lockfile->d_name[0] != '.')
+                unlinkat(dirfd(lockdir), lockfile->d_name, 0);
+        closedir(lockdir);
+        if(!rmdir(lockdirpath))
+            debug("removed lock directory %s\n", lockdirpath);
+    }
+    drop_root();
+    free(lockdirpath);
+}
+
+/**
+ * Remove the lock file pmount takes on mntpt while it mounts, if it was
+ * left behind by a pmount that did not finish.
+ */
+static void
+remove_stale_mntpt_lock(const char *mntpt)
+{
+    char *lockfile = make_lock_path(LOCKDIR, mntpt);
+    int f;
+
+    get_root();
+    if((f = open(lockfile, O_WRONLY | O_CLOEXEC)) >= 0) {
+        if(!lockf(f, F_TEST, 0) && !unlink(lockfile))
+            debug("removed stale lock file %s\n", lockfile);
+        close(f);
+    }
+    drop_root();
+    free(lockfile);
+}
+
+/**
+ * Close a LUKS mapping pmount opened, reporting if it is still in use.
+ */
+static void
+reap_luks(const char *device)
+{
+    switch(luks_close(device)) {
+    case -1:
+        fprintf(stderr,
+                _("Warning: %s could not be closed, "
+                  "run pumount --reap-vanished again later\n"),
+                device);
+        break;
+    case 1:
+        fprintf(stderr, _("%s: closed once no longer in use\n"), device);
+        break;
+    default:
+        fprintf(stderr, _("%s: closed\n"), device);
+    }
+}
+
+/**
+ * Whether device is mounted, according to the snapshot.
+ */
+static int
+in_snapshot(const struct mount_entry *mounts, size_t count,
+            const char *device)
+{
+    for(size_t i = 0; i < count; i++)
+        if(!strcmp(mounts[i].source, device))
+            return 1;
+    return 0;
+}
+
+/**
+ * Detach the allowlisted loop devices whose image has been deleted and
+ * that nothing uses any more.
+ */
+static void
+reap_loop_devices(const struct mount_entry *mounts, size_t count)
+{
+    char **devices = conffile_loop_devices();
+    struct stat st;
+
+    for(; devices && *devices; devices++) {
+        char *sysdir, *holders;
+        DIR *dir;
+        int held = 0, deleted;
+
+        if(!**devices || in_snapshot(mounts, count, *devices) ||
+           stat(*devices, &st) || !S_ISBLK(st.st_mode))
+            continue;
+        if(asprintf(&sysdir, "/sys/dev/block/%u:%u", major(st.st_rdev),
+                    minor(st.st_rdev)) == -1 ||
+           asprintf(&holders, "%s/holders", sysdir) == -1) {
+            perror("asprintf");
+            exit(E_INTERNAL);
+        }
+        deleted = loop_image_deleted(sysdir);
+        if(deleted && (dir = opendir(holders))) {
+            struct dirent *holder;
+
+            while(!held && (holder = readdir(dir)))
+                held = holder->d_name[0] != '.';
+            closedir(dir);
+        }
+        free(holders);
+        free(sysdir);
+        if(!deleted || held)
+            continue;
+
+        if(spawnl(SPAWN_EROOT, LOSETUPPROG, LOSETUPPROG, "-d", *devices,
+                  (char *)NULL))
+            fprintf(stderr, _("Warning: could not detach %s\n"), *devices);
+        else
+            fprintf(stderr, _("%s: image deleted, detached\n"), *devices);
+    }
+}
+
+/**
+ * Clean up after devices that were removed without pumount, from one
+ * snapshot of the mount table: lazily unmount what pmount mounted from
+ * them, close their LUKS mappings and remove their mount points and
+ * locks. Then close the LUKS mappings and detach the loop devices pmount
+ * left behind whose device is gone, and forget about the mappings that
+ * no longer exist.
+ * @return 0 on success, E_EXECUMOUNT if a mount could not be detached
+ */
+static int
+reap_vanished(void)
+{
+    struct mount_entry *mounts;
+    ssize_t count;
+    char *mediadir, **mapped;
+    int rc = 0;
+
+    /* MEDIADIR may be a symlink (for read-only root systems) */
+    if(!(mediadir = realpath(MEDIADIR, NULL))) {
+        fprintf(stderr, "realpath(%s): %s\n", MEDIADIR, strerror(errno));
+        return E_INTERNAL;
+    }
+    count = read_media_mounts(mediadir, &mounts);
+    free(mediadir);
+    if(count < 0)
+        return E_INTERNAL;
+
+    for(ssize_t i = 0; i < count; i++) {
+        const struct mount_entry *m = &mounts[i];
+        const char *reason = device_vanished(m->source, m->dev);
+
+        /* mount points of fstab are not pmount's business */
+        if(!reason || fstab_has_mntpt("/etc/fstab", m->mntpt, NULL))
+            continue;
+
+        recorder_event(REC_DEVICE, 0, m->source);
+        if(spawnl(SPAWN_EROOT | SPAWN_RROOT, UMOUNTPROG, UMOUNTPROG, "-l",
+                  "-d", m->mntpt, (char *)NULL)) {
+            fprintf(stderr, _("Error: could not detach %s from %s\n"),
+                    m->source, m->mntpt);
+            rc = E_EXECUMOUNT;
+            continue;
+        }
+        fprintf(stderr, _("%s: %s, detached from %s\n"), m->source, reason,
+                m->mntpt);
+
+        if(luks_has_lockfile(m->source)) {
+            reap_luks(m->source);
+            /* the mapping of /dev/X is /dev/mapper/_dev_X: the device
+               was locked as /dev/X */
+            if(!strncmp(m->source, LUKS_MAPPER_PREFIX,
+                        sizeof(LUKS_MAPPER_PREFIX) - 1))
+                remove_lock_dir(m->source + sizeof(LUKS_MAPPER_PREFIX) - 1);
+        }
+        remove_lock_dir(m->source);
+        remove_stale_mntpt_lock(m->mntpt);
+        mount_owner_forget(MOUNT_OWNER_DIR, m->mntpt);
+        remove_pmount_mntpt(m->mntpt);
+    }
+
+    /* mappings whose mount was reaped before they could be closed, or
+       that were never mounted */
+    if((mapped = luks_lockfile_devices())) {
+        for(char **d = mapped; *d; d++) {
+            struct stat st;
+            const char *reason;
+
+            if(stat(*d, &st)) {
+                debug("%s does not exist any more, removing its lockfile\n",
+                      *d);
+                luks_remove_lockfile(*d);
+            } else if(!in_snapshot(mounts, count, *d) &&
+                      (reason = device_vanished(*d, 0))) {
+                fprintf(stderr, _("%s: %s\n"), *d, reason);
+                reap_luks(*d);
+            }
+            free(*d);
+        }
+        free(mapped);
+    }
+
+    reap_loop_devices(mounts, count);
+
+    for(ssize_t i = 0; i < count; i++) {
+        free(mounts[i].source);
+        free(mounts[i].mntpt);
+    }
+    free(mounts);
+    return rc;
+}
+
 /**
  * Entry point.
  *
@@ -162,27 +874,31 @@ int
 main(int argc, char *const argv[])
 {
     char *devarg = NULL, *mntptdev = NULL, *device = NULL;
+    char *cache_blockdev = NULL, *cache_backing = NULL;
     const char *fstab_device;
     char fstab_mntpt[MEDIA_STRING_SIZE];
-    int is_real_path = 0;
+    int is_real_path = 0, rc = 0;
+    struct timespec umount_start;
+    double flush;
 
     struct option long_opts[] = {
         { "debug", 0, NULL, 'd' },
         { "help", 0, NULL, 'h' },
+        { "idempotent", 0, &options.idempotent, true },
         { "lazy", 0, NULL, 'l' },
+        { "no-trim", 0, (int *)&options.trim, TRIM_NO },
+        { "reap-vanished", 0, &options.reap, true },
+        { "trim", 0, NULL, 't' },
         { "version", 0, NULL, 'V' },
         { "yes-I-really-want-lazy-unmount", 0, (int *)&options.lazy, true },
         { NULL, 0, NULL, 0 },
     };
 
-    /* initialize locale */
-    setlocale(LC_ALL, "");
-    bindtextdomain("pmount", NULL);
-    textdomain("pmount");
+    recorder_init("pumount");
 
     /* parse command line options */
     while(1) {
-        int option = getopt_long(argc, argv, "+dhlV", long_opts, NULL);
+        int option = getopt_long(argc, argv, "+dhltV", long_opts, NULL);
         if(option == -1) /* end of arguments */
             break;
         switch(option) {
@@ -201,9 +917,14 @@ main(int argc, char *const argv[])
                     "--yes-I-really-want-lazy-unmount\nAborting.\n"),
                   stderr);
             return EXIT_FAILURE;
+        case 't':
+            options.trim = TRIM_YES;
+            break;
         case 'V':
             puts(VERSION);
             return EXIT_SUCCESS;
+        case 0: /* flags */
+            break;
         default:
             fputs(_("Internal error: getopt_long() returned unknown value\n"),
                   stderr);
@@ -212,12 +933,14 @@ main(int argc, char *const argv[])
     }
 
     /* invalid number of args? */
-    if(optind + 1 != argc) {
+    if(optind + !options.reap != argc) {
         usage(argv[0]);
         return E_ARGS;
     }
 
-    devarg = argv[optind];
+    /* unmounts are measured from here on */
+    if(!options.reap)
+        metrics_init(MO_UNMOUNT);
 
     /* are we root? */
     if(!check_root()) {
@@ -236,10 +959,22 @@ main(int argc, char *const argv[])
     drop_root();
     drop_groot();
 
+    if(options.reap) {
+        /* only devices that are gone are touched; root is let through
+           for the uevent handlers, which no one is logged in to run */
+        if(getuid())
+            ensure_user_physically_logged_in(argv[0]);
+        recorder_phase("reap");
+        return reap_vanished();
+    }
+
     /* Check if the user is physically logged in */
     ensure_user_physically_logged_in(argv[0]);
 
+    devarg = argv[optind];
+
     /* if we got a mount point, convert it to a device */
+    recorder_phase("resolve");
     debug("checking whether %s is a mounted directory\n", devarg);
     if(fstab_has_mntpt("/proc/mounts", devarg, &mntptdev)) {
         debug("resolved mount point %s to device %s\n", devarg, mntptdev);
@@ -290,12 +1025,16 @@ main(int argc, char *const argv[])
         /* try to prepend '/dev' */
         if(strncmp(device, DEVDIR, sizeof(DEVDIR) - 1) != 0) {
             char *dev_device, *realpath_dev_device;
-            if(asprintf(&dev_device, "%s%s", DEVDIR, device)) {
+            if(asprintf(&dev_device, "%s%s", DEVDIR, device) == -1) {
                 perror("asprintf");
                 free(device);
                 return E_INTERNAL;
             }
             if(!(realpath_dev_device = realpath(dev_device, NULL))) {
+                if(already_unmounted(device)) {
+                    free(device);
+                    return 0;
+                }
                 fprintf(stderr, "realpath(%s): %s\n", dev_device,
                         strerror(errno));
                 free(device);
@@ -319,6 +1058,10 @@ main(int argc, char *const argv[])
 
     /* does the device start with DEVDIR? */
     if(strncmp(device, DEVDIR, sizeof(DEVDIR) - 1) != 0) {
+        if(already_unmounted(device)) {
+            free(device);
+            return 0;
+        }
         fprintf(stderr, _("Error: invalid device %s (must be in /dev/)\n"),
                 device);
         free(device);
@@ -334,23 +1077,55 @@ main(int argc, char *const argv[])
     }
 
     /* Now, we accept when devices have gone missing */
+    recorder_event(REC_DEVICE, 0, device);
+    recorder_phase("policy");
+    if(already_unmounted(device)) {
+        free(device);
+        return 0;
+    }
     if(check_umount_policy(device, 1)) {
         free(device);
         return E_POLICY;
     }
 
+    /* lazily unmounted devices are still in use, keep their cache */
+    if(!options.lazy && conffile_allow_drop_cache())
+        find_cached_objects(device, &cache_blockdev, &cache_backing);
+
+    /* while the file system is still there to say what is free */
+    if(!options.lazy)
+        do_trim(device);
+
     /* go for it */
+    recorder_phase("umount");
+    set_metrics_fstype(device);
+    clock_gettime(CLOCK_MONOTONIC, &umount_start);
     if(do_umount(device)) {
+        free(cache_blockdev);
+        free(cache_backing);
         free(device);
         return E_EXECUMOUNT;
     }
+    flush = metrics_since(&umount_start);
+    metrics_observe(MH_FLUSH, flush);
+    iostat_report(device, mntpt, flush);
 
     /* release LUKS device, if appropriate */
-    luks_release(device, 1);
+    recorder_phase("luks");
+    if(!strncmp(device, LUKS_MAPPER_PREFIX, sizeof(LUKS_MAPPER_PREFIX) - 1) &&
+       luks_release(device, 1))
+        rc = E_INTERNAL;
     free(device);
 
+    if(cache_blockdev) {
+        drop_page_cache(cache_blockdev, cache_backing);
+        free(cache_blockdev);
+        free(cache_backing);
+    }
+
     /* delete mount point */
+    mount_owner_forget(MOUNT_OWNER_DIR, mntpt);
     remove_pmount_mntpt(mntpt);
 
-    return 0;
+    return rc;
 }
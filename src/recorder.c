@@ -0,0 +1,334 @@
+/**
+ * recorder.c -- flight recorder of pmount and pumount runs
+ *
+ * This software is distributed under the terms and conditions of the
+ * GNU General Public License. See file GPL for the full text of the license.
+ */
+
+#define _GNU_SOURCE
+#include "config.h"
+#include <fcntl.h>
+#include <libintl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "recorder.h"
+#include "utils.h"
+
+#define RECORDER_DIR LOCKDIR "/.recorder"
+#define RECORDER_MAGIC "PMFLIGHT"
+#define RECORDER_VERSION 1
+
+/* must be a power of 2 */
+#define RECORDER_SIZE 128
+
+/** One event, 64 bytes */
+struct recorder_entry {
+    uint64_t ns; /* since recorder_init() */
+    int32_t value;
+    uint16_t type;
+    uint16_t reserved;
+    char arg[48];
+};
+
+/** Header of a dump, followed by the events from the oldest on */
+struct recorder_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_size;
+    uint32_t count; /* number of events that follow */
+    uint32_t lost;  /* older events overwritten in the ring */
+    int32_t pid;
+    uint32_t uid;
+    int32_t status;
+    int32_t signal;
+    int64_t started; /* seconds since the epoch */
+    char program[16];
+};
+
+static struct recorder_entry recorder_ring[RECORDER_SIZE];
+static uint32_t recorder_next = 0;
+
+static struct recorder_header recorder_head = {
+    .magic = RECORDER_MAGIC,
+    .version = RECORDER_VERSION,
+    .entry_size = sizeof(struct recorder_entry),
+};
+static struct timespec recorder_start;
+static uid_t recorder_suid = 0;
+static char recorder_path[128];
+static volatile sig_atomic_t recorder_dumped = 0;
+/* Whether a process of this run (the children of --multiple included)
+   wrote the dump file yet: the others add theirs after it. Shared with
+   the children when possible. */
+static volatile sig_atomic_t recorder_run_dumped_local = 0;
+static volatile sig_atomic_t *recorder_run_dumped = &recorder_run_dumped_local;
+
+static const int recorder_signals[] = {
+    SIGHUP, SIGINT, SIGQUIT, SIGILL, SIGABRT, SIGFPE, SIGSEGV, SIGBUS, SIGTERM,
+};
+
+void
+recorder_event(enum recorder_event type, int value, const char *arg)
+{
+    struct recorder_entry *e =
+        &recorder_ring[recorder_next++ & (RECORDER_SIZE - 1)];
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    e->ns = (uint64_t)(now.tv_sec - recorder_start.tv_sec) * 1000000000 +
+            now.tv_nsec - recorder_start.tv_nsec;
+    e->value = value;
+    e->type = type;
+    if(arg) {
+        size_t len = strlen(arg);
+
+        /* keep the end of long paths, it tells more */
+        if(len >= sizeof(e->arg))
+            arg += len - sizeof(e->arg) + 1;
+        strncpy(e->arg, arg, sizeof(e->arg) - 1);
+        e->arg[sizeof(e->arg) - 1] = 0;
+    } else
+        e->arg[0] = 0;
+}
+
+static int
+recorder_write(int fd, const void *buf, size_t size)
+{
+    const char *p = buf;
+    ssize_t rc;
+
+    while(size > 0) {
+        rc = write(fd, p, size);
+        if(rc < 0)
+            return -1;
+        p += rc;
+        size -= rc;
+    }
+    return 0;
+}
+
+int
+recorder_dump(int fd, int status, int sig)
+{
+    uint32_t next = recorder_next;
+    uint32_t first = next > RECORDER_SIZE ? next - RECORDER_SIZE : 0;
+
+    recorder_head.count = next - first;
+    recorder_head.lost = first;
+    recorder_head.status = status;
+    recorder_head.signal = sig;
+    if(recorder_write(fd, &recorder_head, sizeof(recorder_head)))
+        return -1;
+    for(uint32_t i = first; i < next; i++)
+        if(recorder_write(fd, &recorder_ring[i & (RECORDER_SIZE - 1)],
+                          sizeof(struct recorder_entry)))
+            return -1;
+    return 0;
+}
+
+/**
+   Dumps the recorder to its file. As this may run in a signal
+   handler, it does without get_root() and friends.
+ */
+static void
+recorder_dump_file(int status, int sig)
+{
+    uid_t euid = geteuid();
+    int fd;
+
+    if(recorder_dumped || !recorder_path[0] ||
+       getpid() != recorder_head.pid)
+        return;
+    recorder_dumped = 1;
+
+    if(setresuid(-1, recorder_suid, -1))
+        return;
+    mkdir(LOCKDIR, 0755);
+    mkdir(RECORDER_DIR, 0700);
+    fd = open(recorder_path,
+              O_WRONLY | O_CREAT | O_NOFOLLOW | O_CLOEXEC |
+                  (*recorder_run_dumped ? O_APPEND : O_TRUNC),
+              0600);
+    if(setresuid(-1, euid, -1))
+        _exit(E_INTERNAL);
+    if(fd < 0)
+        return;
+    *recorder_run_dumped = 1;
+    recorder_dump(fd, status, sig);
+    close(fd);
+}
+
+static void
+recorder_on_exit(int status, void *arg)
+{
+    (void)arg;
+    if(status == 0)
+        return;
+    recorder_event(REC_EXIT, status, NULL);
+    recorder_dump_file(status, 0);
+}
+
+static void
+recorder_on_signal(int sig)
+{
+    recorder_event(REC_SIGNAL, sig, NULL);
+    recorder_dump_file(-1, sig);
+    /* the handler was reset: die of the signal */
+    raise(sig);
+}
+
+void
+recorder_init(const char *program)
+{
+    struct sigaction sa;
+    uid_t ruid, euid;
+    void *shared;
+
+    clock_gettime(CLOCK_MONOTONIC, &recorder_start);
+
+    recorder_head.pid = getpid();
+    recorder_head.uid = getuid();
+    recorder_head.started = time(NULL);
+
+    shared = mmap(NULL, sizeof(*recorder_run_dumped), PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(shared != MAP_FAILED)
+        recorder_run_dumped = shared;
+    strncpy(recorder_head.program, program, sizeof(recorder_head.program) - 1);
+
+    if(getresuid(&ruid, &euid, &recorder_suid) ||
+       snprintf(recorder_path, sizeof(recorder_path), RECORDER_DIR "/%s-%u",
+                program, (unsigned)ruid) >= (int)sizeof(recorder_path))
+        recorder_path[0] = 0;
+
+    on_exit(recorder_on_exit, NULL);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = recorder_on_signal;
+    sa.sa_flags = SA_RESETHAND;
+    sigemptyset(&sa.sa_mask);
+    for(size_t i = 0; i < sizeof(recorder_signals) / sizeof(int); i++) {
+        struct sigaction old;
+
+        /* leave alone the signals ignored by whoever started us */
+        if(!sigaction(recorder_signals[i], NULL, &old) &&
+           old.sa_handler == SIG_IGN)
+            continue;
+        sigaction(recorder_signals[i], &sa, NULL);
+    }
+
+    recorder_phase("start");
+}
+
+void
+recorder_fork(void)
+{
+    clock_gettime(CLOCK_MONOTONIC, &recorder_start);
+    recorder_head.pid = getpid();
+    recorder_head.started = time(NULL);
+    recorder_next = 0;
+    recorder_dumped = 0;
+    recorder_phase("start");
+}
+
+static const char *
+recorder_event_name(unsigned type)
+{
+    static const char *names[] = {
+        [REC_PHASE] = "phase", [REC_DEVICE] = "device",
+        [REC_SPAWN] = "spawn", [REC_CHILD] = "child",
+        [REC_ERROR] = "error", [REC_SIGNAL] = "signal",
+        [REC_EXIT] = "exit",
+    };
+
+    if(type < sizeof(names) / sizeof(names[0]) && names[type])
+        return names[type];
+    return "?";
+}
+
+/**
+   Prints the events of the dump whose header is head.
+ */
+static int
+recorder_decode_one(struct recorder_header head, FILE *in, FILE *out)
+{
+    struct recorder_entry e;
+    char started[32];
+    time_t t;
+
+    if(memcmp(head.magic, RECORDER_MAGIC, sizeof(head.magic)) ||
+       head.version != RECORDER_VERSION ||
+       head.entry_size != sizeof(struct recorder_entry)) {
+        fprintf(stderr, _("Error: not a pmount recorder dump\n"));
+        return -1;
+    }
+
+    head.program[sizeof(head.program) - 1] = 0;
+    t = head.started;
+    strftime(started, sizeof(started), "%Y-%m-%d %H:%M:%S", localtime(&t));
+    fprintf(out, "%s[%d] uid %u, started %s, ", head.program, head.pid,
+            head.uid, started);
+    if(head.signal)
+        fprintf(out, "killed by %s\n", strsignal(head.signal));
+    else
+        fprintf(out, "exit status %d\n", head.status);
+    if(head.lost)
+        fprintf(out, "(%u older events lost)\n", head.lost);
+
+    for(uint32_t i = 0; i < head.count; i++) {
+        if(fread(&e, sizeof(e), 1, in) != 1) {
+            fprintf(stderr, _("Error: truncated pmount recorder dump\n"));
+            return -1;
+        }
+        e.arg[sizeof(e.arg) - 1] = 0;
+        fprintf(out, "%12.3f ms  %-6s  ", e.ns / 1e6,
+                recorder_event_name(e.type));
+        switch(e.type) {
+        case REC_SPAWN:
+            fprintf(out, "%s (pid %d)\n", e.arg, e.value);
+            break;
+        case REC_CHILD:
+            fprintf(out, "%s: status %d\n", e.arg, e.value);
+            break;
+        case REC_ERROR:
+            fprintf(out, "%s: %s\n", e.arg, strerror(e.value));
+            break;
+        case REC_SIGNAL:
+            fprintf(out, "%s\n", strsignal(e.value));
+            break;
+        case REC_EXIT:
+            fprintf(out, "status %d\n", e.value);
+            break;
+        default:
+            fprintf(out, "%s\n", e.arg);
+        }
+    }
+    return 0;
+}
+
+int
+recorder_decode(FILE *in, FILE *out)
+{
+    struct recorder_header head;
+    int count = 0;
+
+    /* the processes of a run append their dumps to the same file */
+    while(fread(&head, sizeof(head), 1, in) == 1) {
+        if(count++)
+            fputc('\n', out);
+        if(recorder_decode_one(head, in, out))
+            return -1;
+    }
+    if(!count) {
+        fprintf(stderr, _("Error: not a pmount recorder dump\n"));
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,70 @@
+/**
+ * @file recorder.h - flight recorder of pmount and pumount runs
+ *
+ * This software is distributed under the terms and conditions of the
+ * GNU General Public License. See file GPL for the full text of the license.
+ */
+
+#ifndef __recorder_h
+#define __recorder_h
+
+#include <errno.h>
+#include <stdio.h>
+
+/** The kinds of events recorded */
+enum recorder_event {
+    REC_PHASE = 1, /* a phase of the run starts, arg is its name */
+    REC_DEVICE,    /* arg is the device being worked on */
+    REC_SPAWN,     /* arg is the program run, value its pid */
+    REC_CHILD,     /* arg is the program, value its exit status */
+    REC_ERROR,     /* arg is the failed call, value its errno */
+    REC_SIGNAL,    /* value is the signal received */
+    REC_EXIT,      /* value is the exit status */
+};
+
+/**
+   Starts recording events of the program (pmount or pumount), and
+   arranges for them to be dumped to LOCKDIR/.recorder/<program>-<uid>
+   if the program exits with a non-zero status or is killed by a
+   signal. Call it first thing in main(), while the uids are still
+   those pmount was started with.
+ */
+void recorder_init(const char *program);
+
+/**
+   Makes the recorder that of a forked child which goes on as a run of
+   its own (like the mounts of --multiple): its failures are dumped,
+   after those of the other processes of the run, from a fresh ring.
+ */
+void recorder_fork(void);
+
+/**
+   Records an event in the ring buffer, which keeps the last ones.
+   This is cheap enough to be always on: a clock read and a copy of at
+   most 47 bytes of arg.
+ */
+void recorder_event(enum recorder_event type, int value, const char *arg);
+
+#define recorder_phase(name) recorder_event(REC_PHASE, 0, name)
+
+/** Records that the call what failed with the current errno. */
+#define recorder_error(what) recorder_event(REC_ERROR, errno, what)
+
+/**
+   Writes the recorded events to fd, along with the exit status (or
+   the signal, if sig is not 0). Only uses async-signal-safe calls.
+
+   @return 0 on success, -1 on error
+ */
+int recorder_dump(int fd, int status, int sig);
+
+/**
+   Prints the events of the dumps in in (one per failed process of the
+   run) in a human-readable form.
+
+   @return 0 on success, -1 if in is not a valid dump (message is
+   printed in this case)
+ */
+int recorder_decode(FILE *in, FILE *out);
+
+#endif
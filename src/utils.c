@@ -15,6 +15,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <libintl.h>
+#include <locale.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -26,6 +27,9 @@
 
 #include <unistd.h>
 
+#include "helper.h"
+#include "iostat.h"
+#include "recorder.h"
 #include "utils.h"
 
 /* Error codes */
@@ -40,6 +44,7 @@ const int E_PID = 7;
 const int E_LOCKED = 8;
 const int E_DISALLOWED = 9;
 const int E_LOSETUP = 10;
+const int E_ADMISSION = 11;
 const int E_INTERNAL = 100;
 
 /* File name used to tag directories created by pmount */
@@ -47,6 +52,24 @@ const int E_INTERNAL = 100;
 
 int enable_debug = 0;
 
+char *
+lazy_gettext(const char *msgid)
+{
+    static bool ready = false;
+
+    if(!ready) {
+        int err = errno;
+
+        ready = true;
+        setlocale(LC_CTYPE, "");
+        setlocale(LC_MESSAGES, "");
+        bindtextdomain("pmount", NULL);
+        textdomain("pmount");
+        errno = err;
+    }
+    return gettext(msgid);
+}
+
 int
 debug(const char *format, ...)
 {
@@ -123,12 +146,14 @@ assert_dir_at(int fd, const char *dir, int create_stamp)
     get_root();
     get_groot();
     int rc = mkdirat(fd, dir, 0755);
+    int created = rc == 0;
     if(rc < 0 && errno == EEXIST)
         rc = 0;
     drop_groot();
     drop_root();
 
     if(rc < 0) {
+        recorder_error("mkdir");
         fprintf(stderr, _("Error: could not create directory %s: %s.\n"), dir,
                 strerror(errno));
         return -1;
@@ -136,15 +161,17 @@ assert_dir_at(int fd, const char *dir, int create_stamp)
 
     int dirfd = openat(fd, dir, O_DIRECTORY | O_RDONLY, 0);
     if(dirfd < 0) {
+        recorder_error("open directory");
         fprintf(stderr, _("Error: could not open directory %s: %s\n"), dir,
                 strerror(errno));
         return -1;
     }
 
-    if(create_stamp) {
+    if(create_stamp && created) {
         int stampfile;
         /* create stamp file to indicate that the directory should be
-         * removed again at unmounting */
+         * removed again at unmounting; directories that already existed
+         * keep theirs, if any */
         get_root();
         get_groot();
         stampfile =
@@ -188,7 +215,8 @@ assert_emptydir(int dirfd)
     while((dirent = readdir(dir))) {
         if(strcmp(dirent->d_name, ".") != 0 &&
            strcmp(dirent->d_name, "..") != 0 &&
-           strcmp(dirent->d_name, CREATED_DIR_STAMP) != 0) {
+           strcmp(dirent->d_name, CREATED_DIR_STAMP) != 0 &&
+           strcmp(dirent->d_name, IOSTAT_SNAPSHOT) != 0) {
             closedir(dir);
             fputs(_("Error: directory is not empty\n"), stderr);
             return -1;
@@ -224,18 +252,21 @@ is_block(const char *path)
 int
 remove_pmount_mntpt(const char *path)
 {
-    char *stampfile;
+    char *stampfile, *snapshot;
     int result = 0;
 
-    if(asprintf(&stampfile, "%s/" CREATED_DIR_STAMP, path) == -1) {
+    if(asprintf(&stampfile, "%s/" CREATED_DIR_STAMP, path) == -1 ||
+       asprintf(&snapshot, "%s/" IOSTAT_SNAPSHOT, path) == -1) {
         perror("asprintf");
         return -1;
     }
 
     get_root();
+    unlink(snapshot);
     if(!unlink(stampfile))
         result = rmdir(path);
     drop_root();
+    free(snapshot);
     free(stampfile);
     return result;
 }
@@ -435,6 +466,97 @@ size_t slurp_size = 0;
 #define DEVNULL_MASK (SPAWN_NO_STDOUT | SPAWN_NO_STDERR)
 #define SLURP_MASK (SPAWN_SLURP_STDOUT | SPAWN_SLURP_STDERR)
 
+/**
+   The child side of the spawn functions: sets up the privileges and
+   the redirections, and executes path. Never returns.
+ */
+static void
+spawn_exec(int options, const int *fds, int stdin_fd, const char *path,
+           char *const argv[])
+{
+    if(options & SPAWN_EROOT)
+        get_root();
+    if(options & SPAWN_RROOT)
+        if(setreuid(0, -1)) {
+            perror(_("Error: could not raise to full root uid privileges"));
+            _exit(E_INTERNAL);
+        }
+
+    /* Before the redirections, so that its debug messages are
+       not mixed with the slurped output */
+    helper_apply_sched(path);
+
+    /* Performing redirections */
+
+    if(stdin_fd >= 0) {
+        dup2(stdin_fd, 0);
+        close(stdin_fd);
+    }
+    if(options & DEVNULL_MASK) {
+        int devnull = open("/dev/null", O_WRONLY);
+        if(devnull != -1) {
+            if(options & SPAWN_NO_STDOUT)
+                dup2(devnull, 1);
+            if(options & SPAWN_NO_STDERR)
+                dup2(devnull, 2);
+            close(devnull); /* Now useless */
+        } else {
+            perror("open(\"/dev/null\")");
+            _exit(E_INTERNAL);
+        }
+    }
+    if(options & SLURP_MASK) {
+        close(fds[0]); /* Close the read end of the pipe */
+
+        if(options & SPAWN_SLURP_STDOUT)
+            dup2(fds[1], 1);
+        if(options & SPAWN_SLURP_STDERR)
+            dup2(fds[1], 2);
+        close(fds[1]); /* Now useless */
+    }
+
+    if(options & SPAWN_SEARCHPATH)
+        execvp(path, argv);
+    else
+        execv(path, argv);
+    perror("exec");
+    /* not exit(): the handlers of the parent are not for the child */
+    _exit(E_INTERNAL);
+}
+
+static void
+spawn_debug(const char *path, char *const argv[])
+{
+    if(enable_debug) {
+        printf("spawnv(): executing %s", path);
+        for(int i = 0; argv[i]; ++i)
+            printf(" '%s'", argv[i]);
+        printf("\n");
+    }
+}
+
+/**
+   Decodes the status of a child for the spawn functions.
+
+   @return its exit status, or -1 if it did not exit
+ */
+static int
+spawn_status(int status, const char *path)
+{
+    if(!WIFEXITED(status)) {
+        recorder_event(REC_CHILD, -1, path);
+        fprintf(stderr,
+                "Internal error: spawn(): process did not return a status");
+        return -1;
+    }
+
+    status = WEXITSTATUS(status);
+    recorder_event(REC_CHILD, status, path);
+    debug("spawn(): %s terminated with status %i\n", path ? path : "child",
+          status);
+    return status;
+}
+
 int
 spawnv(int options, const char *path, char *const argv[])
 {
@@ -443,106 +565,96 @@ spawnv(int options, const char *path, char *const argv[])
     int fds[2];
 
     if((options & SLURP_MASK) && pipe(fds)) {
+        recorder_error("pipe");
         perror(_("Impossible to setup pipes for subprocess communication"));
         return -1;
     }
 
-    if(enable_debug) {
-        printf("spawnv(): executing %s", path);
-        for(int i = 0; argv[i]; ++i)
-            printf(" '%s'", argv[i]);
-        printf("\n");
-    }
+    spawn_debug(path, argv);
 
+    /* Pending output would otherwise be duplicated in the child */
+    fflush(stdout);
     new_pid = fork();
     if(new_pid == -1) {
+        recorder_error("fork");
         perror(_("Impossible to fork"));
         return -1;
     }
 
-    if(new_pid == 0) {
-        if(options & SPAWN_EROOT)
-            get_root();
-        if(options & SPAWN_RROOT)
-            if(setreuid(0, -1)) {
-                perror(_("Error: could not raise to full root uid privileges"));
-                exit(E_INTERNAL);
-            }
+    if(new_pid == 0)
+        spawn_exec(options, fds, -1, path, argv);
 
-        /* Performing redirections */
-
-        if(options & DEVNULL_MASK) {
-            int devnull = open("/dev/null", O_WRONLY);
-            if(devnull != -1) {
-                if(options & SPAWN_NO_STDOUT)
-                    dup2(devnull, 1);
-                if(options & SPAWN_NO_STDERR)
-                    dup2(devnull, 2);
-                close(devnull); /* Now useless */
-            } else {
-                perror("open(\"/dev/null\")");
-                exit(E_INTERNAL);
-            }
-        }
-        if(options & SLURP_MASK) {
-            close(fds[0]); /* Close the read end of the pipe */
-
-            if(options & SPAWN_SLURP_STDOUT)
-                dup2(fds[1], 1);
-            if(options & SPAWN_SLURP_STDERR)
-                dup2(fds[1], 2);
-            close(fds[1]); /* Now useless */
-        }
+    recorder_event(REC_SPAWN, new_pid, path);
 
-        if(options & SPAWN_SEARCHPATH)
-            execvp(path, argv);
-        else
-            execv(path, argv);
-        perror("exec");
-        exit(E_INTERNAL);
-    } else {
-
-        /* First, slurp all data */
-        if(options & SLURP_MASK) {
-            close(fds[1]); /* We don't need it */
-            int nb_read = 0;
-            slurp_size = 0;
-            do {
-                nb_read = read(fds[0], slurp_buffer + slurp_size,
-                               sizeof(slurp_buffer) - 1 - slurp_size);
-                if(nb_read < 0) {
-                    perror(_("Error while reading from child process"));
-                    return -1;
-                }
-                slurp_size += nb_read;
-                if(slurp_size == sizeof(slurp_buffer) - 1)
-                    break;
-            } while(nb_read);
-
-            if(nb_read) {
-                fputs(_("Child process output has exceeded buffer size, please "
-                        "file a bug report"),
-                      stderr);
+    /* First, slurp all data */
+    if(options & SLURP_MASK) {
+        close(fds[1]); /* We don't need it */
+        int nb_read = 0;
+        slurp_size = 0;
+        do {
+            nb_read = read(fds[0], slurp_buffer + slurp_size,
+                           sizeof(slurp_buffer) - 1 - slurp_size);
+            if(nb_read < 0) {
+                perror(_("Error while reading from child process"));
+                return -1;
             }
-            close(fds[0]); /* We close the reading end of the pipe */
-            slurp_buffer[slurp_size] = 0; /* Make it nul-terminated */
+            slurp_size += nb_read;
+            if(slurp_size == sizeof(slurp_buffer) - 1)
+                break;
+        } while(nb_read);
+
+        if(nb_read) {
+            fputs(_("Child process output has exceeded buffer size, please "
+                    "file a bug report"),
+                  stderr);
         }
+        close(fds[0]); /* We close the reading end of the pipe */
+        slurp_buffer[slurp_size] = 0; /* Make it nul-terminated */
+    }
 
-        if(wait(&status) < 0) {
-            perror("Error: could not wait for executed subprocess");
-            return -1;
-        }
+    /* only this child: others may have been started by spawn_start() */
+    if(waitpid(new_pid, &status, 0) < 0) {
+        recorder_error("wait");
+        perror("Error: could not wait for executed subprocess");
+        return -1;
     }
+    return spawn_status(status, path);
+}
 
-    if(!WIFEXITED(status)) {
-        fprintf(stderr,
-                "Internal error: spawn(): process did not return a status");
+pid_t
+spawn_start(int options, int stdin_fd, const char *path, char *const argv[])
+{
+    pid_t new_pid;
+
+    spawn_debug(path, argv);
+
+    /* Pending output would otherwise be duplicated in the child */
+    fflush(stdout);
+    new_pid = fork();
+    if(new_pid == -1) {
+        recorder_error("fork");
+        perror(_("Impossible to fork"));
         return -1;
     }
+    if(new_pid == 0)
+        spawn_exec(options & ~SLURP_MASK, NULL, stdin_fd, path, argv);
+    recorder_event(REC_SPAWN, new_pid, path);
+    return new_pid;
+}
 
-    status = WEXITSTATUS(status);
-    debug("spawn(): %s terminated with status %i\n", path, status);
-    return status;
+int
+spawn_wait(pid_t *pid)
+{
+    int status;
+    pid_t done = waitpid(*pid, &status, 0);
+
+    if(done < 0) {
+        recorder_error("wait");
+        perror("Error: could not wait for executed subprocess");
+        return -1;
+    }
+    *pid = done;
+    return spawn_status(status, NULL);
 }
 
 int
@@ -558,6 +670,7 @@ lock_dir(const char *dir)
     drop_root();
     free(lockfile);
     if(f < 0) {
+        recorder_error("lock_dir: creat");
         perror("lock_dir(): creat");
         return -1;
     }
@@ -565,6 +678,7 @@ lock_dir(const char *dir)
     if(lockf(f, F_TLOCK, 0) == 0)
         return 0;
 
+    recorder_error("lock_dir: lockf");
     if(errno != EAGAIN)
         perror("lock_dir(): lockf");
     return -1;
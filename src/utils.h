@@ -16,6 +16,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <sys/types.h>
 
 /* Error codes */
 extern const int E_ARGS;
@@ -32,12 +33,21 @@ extern const int E_LOCKED;
 extern const int E_DISALLOWED;
 /** Something failed with loop devices */
 extern const int E_LOSETUP;
+/** Too many mounts in progress, or too many for the device */
+extern const int E_ADMISSION;
 extern const int E_INTERNAL;
 
 /**
- * gettext abbreviation
+ * gettext abbreviation; the message catalog is only set up when the
+ * first message is translated
  */
-#define _(String) gettext(String)
+#define _(String) lazy_gettext(String)
+
+/**
+ * gettext() that sets up the locale categories it needs (LC_CTYPE and
+ * LC_MESSAGES) and the text domain on its first call. Preserves errno.
+ */
+char *lazy_gettext(const char *msgid) __attribute__((format_arg(1)));
 
 /**
  * global flag whether to print debug messages (false by default)
@@ -72,8 +82,8 @@ char *make_lock_path(const char *prefix, const char *device);
 
 /**
  * If dir already exists, check that it is a directory; if it does not exist,
- * create it. If create_stamp is true, put a stamp file into it (so that it
- * will be removed again on unmounting).
+ * create it. If create_stamp is true and the directory was created, put a
+ * stamp file into it (so that it will be removed again on unmounting).
  * Returns a directory descriptor associated with the dir path. Needs to be
  * closed by the caller.
  * @return the dirfd or -1 on error (message is printed in this case)
@@ -233,4 +243,24 @@ int spawnl(int options, const char *path, ...);
  */
 int spawnv(int options, const char *path, char *const argv[]);
 
+/**
+ * Spawn a subprocess without waiting for it, to run several at once.
+ * @param options Combination of SPAWN_* flags, except the SLURP ones
+ * @param stdin_fd descriptor to use as its standard input (closed in the
+ *        child), or -1 to keep ours
+ * @param path Path to program to be executed
+ * @param argv NULL terminated argument vector (including argv[0]!)
+ * @return its pid, or -1 if it could not be started
+ */
+pid_t spawn_start(int options, int stdin_fd, const char *path,
+                  char *const argv[]);
+
+/**
+ * Wait for a subprocess started with spawn_start().
+ * @param pid the subprocess to wait for, or -1 for the first one to
+ *        terminate; set to the pid of the one that did
+ * @return its exit status, or -1 if it did not exit normally
+ */
+int spawn_wait(pid_t *pid);
+
 #endif /* __utils_h */
@@ -0,0 +1,17 @@
+#!/bin/sh
+#
+# Latency of the file system detection paths, per image of the corpus
+# of make_corpus.sh, in microseconds.
+#
+# Usage: bench_detect.sh <test_detect> [runs]
+
+set -eu
+
+detect=$1
+runs=${2:-200}
+here=$(dirname "$0")
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+sh "$here/make_corpus.sh" "$dir"
+"$detect" -b "$runs" "$dir"
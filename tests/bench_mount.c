@@ -0,0 +1,299 @@
+/*
+ * This software is distributed under the terms and conditions of the
+ * GNU General Public License. See file GPL for the full text of the license.
+ */
+
+/**
+   This program compares mount profiles on devices holding an empty file
+   system: it mounts each with the options pmount would build for every
+   profile, runs the same workload every time, and prints the throughput
+   and the fsync latency. The workload writes many small files (each
+   followed by fsync), then one large file (followed by fsync), and scans
+   the directory tree after a remount, so that it is not in the cache.
+   With -l, it prints the file systems pmount can mount read-write, for
+   bench_mount.sh to make images of. It must be run as root.
+ */
+
+#define _GNU_SOURCE
+#include "config.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fs.h"
+#include "utils.h"
+
+#define SMALL_FILES 1000
+#define SMALL_SIZE 4096
+#define CHUNK (1024 * 1024)
+
+/** Candidate option sets, on top of the defaults of pmount */
+static const struct {
+    const char *name;
+    int sync;
+    int noatime;
+    const char *extra;
+} profiles[] = {
+    { "default", 0, 0, NULL },
+    { "sync", 1, 0, NULL },
+    { "noatime", 0, 1, NULL },
+    { "lazytime", 0, 0, "lazytime" },
+    { "noatime,lazytime", 0, 1, "lazytime" },
+    { "flush", 0, 0, "flush" },
+    { "commit=60", 0, 0, "commit=60" },
+    { "noatime,commit=60", 0, 1, "commit=60" },
+};
+
+#define NB_PROFILES (sizeof(profiles) / sizeof(profiles[0]))
+
+static double
+since(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static int
+compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+   Mounts device on mntpt with the options of profile p.
+   @return 0 on success, or the exit status of mount
+ */
+static int
+mount_profile(const char *device, const char *fsname, const char *mntpt,
+              size_t p)
+{
+    struct mount_request request = {
+        .async = !profiles[p].sync,
+        .noatime = profiles[p].noatime,
+        .uid = getuid(),
+        .gid = getgid(),
+        .extra = profiles[p].extra,
+    };
+    char opts[1000];
+
+    if(!fs_mount_options(fsname, &request, opts, sizeof(opts)))
+        return -1;
+    return spawnl(SPAWN_NO_STDOUT | SPAWN_NO_STDERR, MOUNTPROG, MOUNTPROG,
+                  "-t", fsname, "-o", opts, device, mntpt, (char *)NULL);
+}
+
+static int
+umount_profile(const char *mntpt)
+{
+    return spawnl(0, UMOUNTPROG, UMOUNTPROG, mntpt, (char *)NULL);
+}
+
+/**
+   Writes SMALL_FILES files of SMALL_SIZE bytes in dir, each one followed
+   by fsync, whose latencies go to lat.
+   @return the elapsed time, or -1 on error
+ */
+static double
+write_small_files(const char *dir, double *lat)
+{
+    static char buf[SMALL_SIZE];
+    struct timespec start, one;
+    char path[4096];
+
+    memset(buf, 'p', sizeof(buf));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(int i = 0; i < SMALL_FILES; i++) {
+        int fd;
+
+        if(snprintf(path, sizeof(path), "%s/d%02d/f%04d", dir, i % 50, i) >=
+           (int)sizeof(path)) {
+            fprintf(stderr, "%s: path too long\n", dir);
+            return -1;
+        }
+        if(i < 50) {
+            char *slash = strrchr(path, '/');
+
+            *slash = 0;
+            if(mkdir(path, 0755)) {
+                perror(path);
+                return -1;
+            }
+            *slash = '/';
+        }
+        fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0 || write(fd, buf, sizeof(buf)) != sizeof(buf)) {
+            perror(path);
+            return -1;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &one);
+        fsync(fd);
+        lat[i] = since(&one);
+        close(fd);
+    }
+    return since(&start);
+}
+
+/**
+   Writes a file of size MiB in dir, followed by fsync, whose latency goes
+   to lat.
+   @return the elapsed time, or -1 on error
+ */
+static double
+write_large_file(const char *dir, int size, double *lat)
+{
+    struct timespec start, sync;
+    char path[4096], *buf;
+    int fd;
+
+    if(!(buf = malloc(CHUNK)))
+        return -1;
+    memset(buf, 'p', CHUNK);
+    if(snprintf(path, sizeof(path), "%s/large", dir) >= (int)sizeof(path)) {
+        fprintf(stderr, "%s: path too long\n", dir);
+        free(buf);
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+        perror(path);
+        free(buf);
+        return -1;
+    }
+    for(int i = 0; i < size; i++)
+        if(write(fd, buf, CHUNK) != CHUNK) {
+            perror(path);
+            close(fd);
+            free(buf);
+            return -1;
+        }
+    clock_gettime(CLOCK_MONOTONIC, &sync);
+    fsync(fd);
+    *lat = since(&sync);
+    close(fd);
+    free(buf);
+    return since(&start);
+}
+
+/**
+   Stats every entry below dir.
+   @return the number of entries
+ */
+static long
+scan(const char *dir)
+{
+    struct dirent *entry;
+    struct stat st;
+    long count = 0;
+    DIR *d;
+
+    if(!(d = opendir(dir)))
+        return 0;
+    while((entry = readdir(d))) {
+        char path[4096];
+
+        if(!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        if(lstat(path, &st))
+            continue;
+        count++;
+        if(S_ISDIR(st.st_mode))
+            count += scan(path);
+    }
+    closedir(d);
+    return count;
+}
+
+/**
+   Runs the workload on a fresh directory of the mounted file system and
+   prints its line of results.
+ */
+static int
+run_profile(const char *device, const char *fsname, const char *mntpt,
+            int size, size_t p)
+{
+    static double lat[SMALL_FILES];
+    double small, large, large_lat, scan_time;
+    struct timespec start;
+    char dir[4096];
+    long entries;
+
+    snprintf(dir, sizeof(dir), "%s/run%zu", mntpt, p);
+    if(mkdir(dir, 0755)) {
+        perror(dir);
+        return -1;
+    }
+    if((small = write_small_files(dir, lat)) < 0 ||
+       (large = write_large_file(dir, size, &large_lat)) < 0)
+        return -1;
+
+    /* cold cache for the scan */
+    if(umount_profile(mntpt) || mount_profile(device, fsname, mntpt, p))
+        return -1;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    entries = scan(dir);
+    scan_time = since(&start);
+
+    snprintf(dir, sizeof(dir), "%s/run%zu/large", mntpt, p);
+    unlink(dir);
+
+    qsort(lat, SMALL_FILES, sizeof(*lat), compare_double);
+    printf("%-8s %-18s %9.0f %8.2f %8.2f %9.1f %8.2f %9.0f\n", fsname,
+           profiles[p].name, SMALL_FILES / small,
+           lat[SMALL_FILES / 2] * 1e3, lat[SMALL_FILES * 99 / 100] * 1e3,
+           size / large, large_lat * 1e3, entries / scan_time);
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *mntpt;
+    int size, rc = 0;
+
+    if(argc == 2 && !strcmp(argv[1], "-l")) {
+        for(const struct FS *fs = get_supported_fs(); fs->fsname; fs++)
+            if(!fs->skip_autodetect && !strstr(fs->options, ",ro"))
+                puts(fs->fsname);
+        return 0;
+    }
+    if(argc < 5 || argc % 2 == 0) {
+        fprintf(stderr,
+                "Usage: %s <mount point> <MiB> <device> <fs> "
+                "[<device> <fs>...]\n       %s -l\n",
+                argv[0], argv[0]);
+        return 1;
+    }
+    mntpt = argv[1];
+    if((size = atoi(argv[2])) <= 0) {
+        fprintf(stderr, "%s: invalid size\n", argv[2]);
+        return 1;
+    }
+
+    printf("%-8s %-18s %9s %8s %8s %9s %8s %9s\n", "fs", "profile",
+           "files/s", "fsync50", "fsync99", "MiB/s", "fsync", "entries/s");
+    printf("%-8s %-18s %9s %8s %8s %9s %8s %9s\n", "", "", "(small)",
+           "(ms)", "(ms)", "(large)", "(ms)", "(scan)");
+    for(int i = 3; i < argc; i += 2) {
+        for(size_t p = 0; p < NB_PROFILES; p++) {
+            if(mount_profile(argv[i], argv[i + 1], mntpt, p)) {
+                printf("%-8s %-18s   (options refused)\n", argv[i + 1],
+                       profiles[p].name);
+                continue;
+            }
+            if(run_profile(argv[i], argv[i + 1], mntpt, size, p))
+                rc = 1;
+            umount_profile(mntpt);
+        }
+    }
+    return rc;
+}
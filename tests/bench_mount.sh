@@ -0,0 +1,85 @@
+#!/bin/sh
+#
+# Compares mount profiles (sync, noatime, lazytime, flush, commit=...)
+# on every file system pmount can mount read-write and that can be made
+# here: makes an image of each, attaches it to a loop device and runs
+# bench_mount on them. Needs root for losetup and mount; skipped
+# otherwise.
+#
+# Usage: bench_mount.sh <bench_mount> [MiB written in one file]
+
+set -eu
+
+bench=$1
+size=${2:-64}
+
+if [ "$(id -u)" != 0 ] || ! command -v losetup >/dev/null; then
+    echo "bench_mount: needs root and losetup, skipped"
+    exit 77
+fi
+
+dir=$(mktemp -d)
+loops=
+cleanup() {
+    umount "$dir/mnt" 2>/dev/null || true
+    for loop in $loops; do
+        losetup -d "$loop" || true
+    done
+    rm -rf "$dir"
+}
+trap cleanup EXIT
+mkdir "$dir/mnt"
+
+# the first of the given programs that is installed
+tool() {
+    for t in "$@"; do
+        if command -v "$t" >/dev/null 2>&1; then
+            echo "$t"
+            return 0
+        fi
+    done
+    return 1
+}
+
+# the command making an empty file system of the given type
+mkfs_command() {
+    case $1 in
+    ext2 | ext3 | ext4) t=$(tool "mkfs.$1") && echo "$t -q -F" ;;
+    vfat) tool mkfs.vfat mkfs.fat mkdosfs ;;
+    exfat) tool mkfs.exfat ;;
+    ntfs) t=$(tool mkfs.ntfs mkntfs) && echo "$t -q -F -Q" ;;
+    hfsplus) tool mkfs.hfsplus ;;
+    btrfs) t=$(tool mkfs.btrfs) && echo "$t -q" ;;
+    f2fs) t=$(tool mkfs.f2fs) && echo "$t -q" ;;
+    nilfs2) t=$(tool mkfs.nilfs2) && echo "$t -q" ;;
+    reiserfs) t=$(tool mkfs.reiserfs mkreiserfs) && echo "$t -q -f -f" ;;
+    xfs) t=$(tool mkfs.xfs) && echo "$t -q" ;;
+    jfs) t=$(tool mkfs.jfs jfs_mkfs) && echo "$t -q" ;;
+    udf) t=$(tool mkudffs mkfs.udf) && echo "$t --blocksize=512" ;;
+    *) return 1 ;;
+    esac
+}
+
+args=
+for fs in $("$bench" -l); do
+    if ! cmd=$(mkfs_command "$fs"); then
+        echo "bench_mount: cannot make $fs here, skipped" >&2
+        continue
+    fi
+    # room for the large file, and xfs wants 300 MiB at least
+    truncate -s "$((size * 2 + 320))M" "$dir/$fs"
+    if ! $cmd "$dir/$fs" >/dev/null 2>&1; then
+        echo "bench_mount: $cmd failed, $fs skipped" >&2
+        continue
+    fi
+    loop=$(losetup -f --show "$dir/$fs")
+    loops="$loops $loop"
+    args="$args $loop $fs"
+done
+
+if [ -z "$args" ]; then
+    echo "bench_mount: no image could be made, skipped"
+    exit 77
+fi
+# shellcheck disable=SC2086
+"$bench" "$dir/mnt" "$size" $args
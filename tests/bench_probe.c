@@ -0,0 +1,65 @@
+/**
+ * bench_probe.c - times the engines of probe_devices() on a set of devices
+ *
+ * This software is distributed under the terms and conditions of the
+ * GNU General Public License. See file GPL for the full text of the license.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "probe.h"
+
+static const struct {
+    const char *name;
+    enum probe_engine engine;
+} engines[] = {
+    { "sequential", PROBE_SEQUENTIAL },
+    { "threads", PROBE_THREADS },
+    { "io_uring", PROBE_URING },
+};
+
+int
+main(int argc, char *argv[])
+{
+    struct probe_result *results;
+    size_t n;
+    int runs;
+
+    if(argc < 3) {
+        fprintf(stderr, "Usage: %s <runs> <device>...\n", argv[0]);
+        return 1;
+    }
+    runs = atoi(argv[1]);
+    n = argc - 2;
+    results = calloc(n, sizeof(*results));
+    if(!results || runs <= 0)
+        return 1;
+    for(size_t i = 0; i < n; i++)
+        results[i].device = argv[i + 2];
+
+    for(size_t e = 0; e < sizeof(engines) / sizeof(engines[0]); e++) {
+        struct timespec start, end;
+        enum probe_engine used = engines[e].engine;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for(int r = 0; r < runs; r++)
+            used = probe_devices(results, n, engines[e].engine);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        for(size_t i = 0; i < n; i++)
+            if(results[i].error) {
+                fprintf(stderr, "%s: %s\n", results[i].device,
+                        "could not be read");
+                return 1;
+            }
+        printf("%-12s %8ld us%s\n", engines[e].name,
+               ((end.tv_sec - start.tv_sec) * 1000000000L + end.tv_nsec -
+                start.tv_nsec) / runs / 1000,
+               used != engines[e].engine ? " (fell back to threads)" : "");
+    }
+    free(results);
+    return 0;
+}
@@ -0,0 +1,41 @@
+#!/bin/sh
+#
+# Probing the headers of several devices at once: attaches images to
+# loop devices and prints the mean time of one batch with each engine,
+# in microseconds. Needs root for losetup; skipped otherwise.
+#
+# Usage: bench_probe.sh <bench_probe> [devices] [runs]
+
+set -eu
+
+bench=$1
+count=${2:-16}
+runs=${3:-50}
+
+if [ "$(id -u)" != 0 ] || ! command -v losetup >/dev/null; then
+    echo "bench_probe: needs root and losetup, skipped"
+    exit 77
+fi
+
+dir=$(mktemp -d)
+loops=
+cleanup() {
+    for loop in $loops; do
+        losetup -d "$loop" || true
+    done
+    rm -rf "$dir"
+}
+trap cleanup EXIT
+
+i=0
+while [ "$i" -lt "$count" ]; do
+    truncate -s 8M "$dir/img$i"
+    if command -v mkfs.ext4 >/dev/null; then
+        mkfs.ext4 -q -F "$dir/img$i"
+    fi
+    loops="$loops $(losetup -f --show "$dir/img$i")"
+    i=$((i + 1))
+done
+
+# shellcheck disable=SC2086
+"$bench" "$runs" $loops
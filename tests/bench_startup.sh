@@ -0,0 +1,34 @@
+#!/bin/sh
+#
+# Startup cost of the short pmount and pumount invocations: prints the
+# mean wall time of each mode, in microseconds.
+#
+# Usage: bench_startup.sh <pmount> <pumount> [runs]
+
+set -eu
+
+pmount=$1
+pumount=$2
+runs=${3:-200}
+
+bench() {
+    name=$1
+    shift
+    start=$(date +%s%N)
+    i=0
+    while [ "$i" -lt "$runs" ]; do
+        "$@" >/dev/null 2>&1 || true
+        i=$((i + 1))
+    done
+    end=$(date +%s%N)
+    printf '%-16s %8d us\n' "$name" $(((end - start) / runs / 1000))
+}
+
+bench "list" "$pmount"
+bench "version" "$pmount" --version
+bench "metrics" "$pmount" --metrics
+bench "lock" "$pmount" --lock /dev/null $$
+bench "unlock" "$pmount" --unlock /dev/null $$
+bench "mount-invalid" "$pmount" /dev/null
+bench "pumount-missing" "$pumount" /nonexistent
+bench "help" "$pmount" --help
@@ -0,0 +1,157 @@
+#!/bin/sh
+#
+# Generates a corpus of small images, one per file system pmount knows
+# of plus LUKS and a few ambiguous layouts, for test_detect.sh and
+# bench_detect.sh. Each image is listed in <dir>/MANIFEST with the type
+# blkid should find; images whose mkfs tool is not installed are left
+# out, and listed in <dir>/SKIPPED.
+#
+# Usage: make_corpus.sh <dir>
+
+set -eu
+
+dir=$1
+mkdir -p "$dir/tree"
+: >"$dir/MANIFEST"
+: >"$dir/SKIPPED"
+echo "pmount test corpus" >"$dir/tree/README"
+
+# the first of the given programs that is installed
+tool() {
+    for t in "$@"; do
+        if command -v "$t" >/dev/null 2>&1; then
+            echo "$t"
+            return 0
+        fi
+    done
+    return 1
+}
+
+add() {
+    echo "$1 $2" >>"$dir/MANIFEST"
+}
+
+skip() {
+    echo "$1 (no $2)" >>"$dir/SKIPPED"
+}
+
+# mkfs-style tools: name, expected type, size, tool candidates, options
+mkfs_image() {
+    name=$1
+    type=$2
+    size=$3
+    tools=$4
+    shift 4
+    if ! t=$(tool $tools); then
+        skip "$name" "$tools"
+        return 0
+    fi
+    rm -f "$dir/$name"
+    truncate -s "$size" "$dir/$name"
+    if "$t" "$@" "$dir/$name" >/dev/null 2>&1; then
+        add "$name" "$type"
+    else
+        echo "make_corpus: $t failed on $name" >&2
+        rm -f "$dir/$name"
+        skip "$name" "working $t"
+    fi
+}
+
+# writes the hex bytes into image at offset
+poke() {
+    bytes=
+    for b in $(echo "$3" | sed 's/../& /g'); do
+        bytes="$bytes\\$(printf %o "0x$b")"
+    done
+    printf "$bytes" | dd of="$1" bs=1 seek="$2" conv=notrunc status=none
+}
+
+mkfs_image ext2 ext2 4M mkfs.ext2 -q -F
+mkfs_image ext3 ext3 4M mkfs.ext3 -q -F
+mkfs_image ext4 ext4 4M mkfs.ext4 -q -F
+mkfs_image vfat vfat 4M "mkfs.vfat mkfs.fat mkdosfs"
+mkfs_image exfat exfat 8M mkfs.exfat
+mkfs_image ntfs ntfs 8M "mkfs.ntfs mkntfs" -q -F -Q
+mkfs_image hfsplus hfsplus 8M "mkfs.hfsplus mkfs.hfs+"
+mkfs_image hfs hfs 8M "hformat mkfs.hfs"
+mkfs_image btrfs btrfs 128M mkfs.btrfs -q
+mkfs_image f2fs f2fs 64M mkfs.f2fs -q
+mkfs_image nilfs2 nilfs2 128M mkfs.nilfs2 -q
+mkfs_image reiserfs reiserfs 64M "mkfs.reiserfs mkreiserfs" -q -f -f
+mkfs_image reiser4 reiser4 64M mkfs.reiser4 -y -f
+mkfs_image xfs xfs 320M mkfs.xfs -q
+mkfs_image jfs jfs 16M "mkfs.jfs jfs_mkfs" -q
+mkfs_image omfs omfs 8M mkomfs
+mkfs_image udf udf 8M "mkudffs mkfs.udf" --blocksize=512
+
+# read-only file systems are built from a directory
+if t=$(tool xorriso genisoimage mkisofs); then
+    [ "$t" = xorriso ] && t="xorriso -as mkisofs"
+    $t -quiet -o "$dir/iso9660" "$dir/tree" 2>/dev/null
+    add iso9660 iso9660
+    # isohybrid: a DOS partition table in the system area of the ISO
+    cp "$dir/iso9660" "$dir/iso-hybrid"
+    poke "$dir/iso-hybrid" 446 "80000000170000000000000000100000"
+    poke "$dir/iso-hybrid" 510 55aa
+    add iso-hybrid iso9660
+else
+    skip iso9660 "xorriso genisoimage mkisofs"
+    skip iso-hybrid "xorriso genisoimage mkisofs"
+fi
+if t=$(tool mksquashfs); then
+    $t "$dir/tree" "$dir/squashfs" -quiet -noappend >/dev/null
+    add squashfs squashfs
+else
+    skip squashfs mksquashfs
+fi
+if t=$(tool mkfs.erofs); then
+    $t -q "$dir/erofs" "$dir/tree" >/dev/null
+    add erofs erofs
+else
+    skip erofs mkfs.erofs
+fi
+
+# LUKS: a container, whatever is inside
+if t=$(tool cryptsetup); then
+    echo pmount >"$dir/key"
+    for v in 1 2; do
+        truncate -s 16M "$dir/luks$v"
+        if $t luksFormat -q --type "luks$v" --pbkdf pbkdf2 \
+            --pbkdf-force-iterations 1000 --key-file "$dir/key" \
+            "$dir/luks$v" >/dev/null 2>&1 && $t isLuks "$dir/luks$v"; then
+            add "luks$v" crypto_LUKS
+        else
+            rm -f "$dir/luks$v"
+            skip "luks$v" "working cryptsetup"
+        fi
+    done
+else
+    skip luks1 cryptsetup
+    skip luks2 cryptsetup
+fi
+
+# ambiguous layouts
+if t=$(tool mkfs.vfat mkfs.fat mkdosfs); then
+    # a whole disk: DOS partition table, FAT in the partition at 1 MiB
+    truncate -s 9M "$dir/fat-in-dos"
+    "$t" --offset 2048 "$dir/fat-in-dos" 8192 >/dev/null
+    poke "$dir/fat-in-dos" 446 "000000000c0000000008000000400000"
+    poke "$dir/fat-in-dos" 510 55aa
+    add fat-in-dos dos
+else
+    skip fat-in-dos "mkfs.vfat"
+fi
+if t=$(tool mkfs.ext4); then
+    # a DOS partition table in the boot sector ext4 leaves alone, as
+    # written by tools that "fix" the disk
+    truncate -s 4M "$dir/ext4-stale-mbr"
+    "$t" -q -F "$dir/ext4-stale-mbr" >/dev/null
+    poke "$dir/ext4-stale-mbr" 446 "00000000830000000008000000180000"
+    poke "$dir/ext4-stale-mbr" 510 55aa
+    add ext4-stale-mbr ext4
+else
+    skip ext4-stale-mbr mkfs.ext4
+fi
+
+rm -f "$dir/key"
+rm -rf "$dir/tree"
@@ -0,0 +1,172 @@
+/*
+ * This software is distributed under the terms and conditions of the
+ * GNU General Public License. See file GPL for the full text of the license.
+ */
+
+/**
+   This program checks that the detection paths of pmount agree on the
+   images of a corpus made by make_corpus.sh: the built-in prober used
+   by --probe and, if pmount is built with it, libblkid. With -b, it
+   prints the time each path takes per image instead. With -l, it
+   prints the file systems do_mount_auto() tries, in order, for the
+   trial mounts of test_detect.sh.
+ */
+
+#define _GNU_SOURCE
+#include "config.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fs.h"
+#include "probe.h"
+
+#if HAVE_BLKID
+#include <blkid.h>
+#endif
+
+static unsigned char header[PROBE_READ_SIZE];
+
+static const char *
+detect_builtin(const char *image)
+{
+    int fd = open(image, O_RDONLY | O_CLOEXEC);
+    ssize_t size;
+
+    if(fd < 0) {
+        perror(image);
+        exit(1);
+    }
+    size = pread(fd, header, sizeof(header), 0);
+    close(fd);
+    if(size < 0) {
+        perror(image);
+        exit(1);
+    }
+    return probe_classify(header, size);
+}
+
+#if HAVE_BLKID
+/**
+   The type libblkid finds, or for a bare partition table its type.
+   The result is overwritten by the next call.
+ */
+static const char *
+detect_blkid(const char *image)
+{
+    static char type[32];
+    blkid_probe pr = blkid_new_probe_from_filename(image);
+    const char *data;
+    int found = 0;
+
+    if(!pr) {
+        fprintf(stderr, "%s: libblkid cannot probe it\n", image);
+        exit(1);
+    }
+    blkid_probe_enable_superblocks(pr, 1);
+    blkid_probe_set_superblocks_flags(pr, BLKID_SUBLKS_TYPE);
+    blkid_probe_enable_partitions(pr, 1);
+    if(!blkid_do_safeprobe(pr) &&
+       (!blkid_probe_lookup_value(pr, "TYPE", &data, NULL) ||
+        !blkid_probe_lookup_value(pr, "PTTYPE", &data, NULL))) {
+        snprintf(type, sizeof(type), "%s", data);
+        found = 1;
+    }
+    blkid_free_probe(pr);
+    return found ? type : NULL;
+}
+#endif
+
+static const struct {
+    const char *name;
+    const char *(*detect)(const char *image);
+} paths[] = {
+    { "builtin", detect_builtin },
+#if HAVE_BLKID
+    { "libblkid", detect_blkid },
+#endif
+};
+
+#define NB_PATHS (sizeof(paths) / sizeof(paths[0]))
+
+static double
+elapsed_us(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e6 +
+           (now.tv_nsec - start->tv_nsec) / 1e3;
+}
+
+int
+main(int argc, char *argv[])
+{
+    char *manifest, image[256], expected[32];
+    int runs = 0, rc = 0, images = 0;
+    FILE *f;
+
+    if(argc == 2 && !strcmp(argv[1], "-l")) {
+        /* ntfs-3g, tried only when it is installed, is left out */
+        for(const struct FS *fs = get_supported_fs(); fs->fsname; fs++)
+            if(!fs->skip_autodetect)
+                puts(fs->fsname);
+        return 0;
+    }
+    if(argc == 4 && !strcmp(argv[1], "-b"))
+        runs = atoi(argv[2]);
+    else if(argc != 2) {
+        fprintf(stderr, "Usage: %s [-b <runs>] <corpus>\n       %s -l\n",
+                argv[0], argv[0]);
+        return 1;
+    }
+
+    if(chdir(argv[argc - 1]) || !(f = fopen("MANIFEST", "r"))) {
+        perror(argv[argc - 1]);
+        return 1;
+    }
+    manifest = argv[argc - 1];
+
+    if(runs) {
+        printf("%-16s", "image");
+        for(size_t p = 0; p < NB_PATHS; p++)
+            printf(" %10s", paths[p].name);
+        puts("  (us per detection)");
+    }
+
+    while(fscanf(f, "%255s %31s", image, expected) == 2) {
+        images++;
+        if(runs) {
+            printf("%-16s", image);
+            for(size_t p = 0; p < NB_PATHS; p++) {
+                struct timespec start;
+
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                for(int r = 0; r < runs; r++)
+                    paths[p].detect(image);
+                printf(" %10.1f", elapsed_us(&start) / runs);
+            }
+            putchar('\n');
+            continue;
+        }
+        for(size_t p = 0; p < NB_PATHS; p++) {
+            const char *type = paths[p].detect(image);
+
+            if(!type || strcmp(type, expected)) {
+                fprintf(stderr, "%s: %s found %s, expected %s\n", image,
+                        paths[p].name, type ? type : "nothing", expected);
+                rc = 1;
+            }
+        }
+    }
+    fclose(f);
+
+    if(!images) {
+        fprintf(stderr, "%s: no image could be made\n", manifest);
+        return 77;
+    }
+    return rc;
+}
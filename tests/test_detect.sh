@@ -0,0 +1,59 @@
+#!/bin/sh
+#
+# Differential test of the file system detection: builds the corpus of
+# make_corpus.sh and checks that the built-in prober, libblkid and, when
+# run as root, the trial mounts of do_mount_auto() all find the type
+# each image was made with. Skipped if no image could be made.
+#
+# Usage: test_detect.sh <test_detect>
+
+set -eu
+
+detect=$1
+here=$(dirname "$0")
+dir=$(mktemp -d)
+mnt=$dir/mnt
+loop=
+cleanup() {
+    if [ -n "$loop" ]; then
+        umount "$mnt" 2>/dev/null || true
+        losetup -d "$loop" || true
+    fi
+    rm -rf "$dir"
+}
+trap cleanup EXIT
+
+sh "$here/make_corpus.sh" "$dir/corpus"
+sed 's/^/test_detect: skipped /' "$dir/corpus/SKIPPED"
+
+rc=0
+"$detect" "$dir/corpus" || rc=$?
+[ "$rc" = 77 ] && exit 77
+
+# trial mounts, as pmount does them when libblkid finds nothing
+if [ "$(id -u)" = 0 ] && command -v losetup >/dev/null; then
+    mkdir "$mnt"
+    while read -r image expected; do
+        case "$expected" in
+        crypto_LUKS | dos | gpt) expected=nothing ;;
+        esac
+        loop=$(losetup -f --show -r "$dir/corpus/$image")
+        found=nothing
+        for fs in $("$detect" -l); do
+            if mount -t "$fs" -o ro "$loop" "$mnt" 2>/dev/null; then
+                umount "$mnt"
+                found=$fs
+                break
+            fi
+        done
+        losetup -d "$loop"
+        loop=
+        if [ "$found" != "$expected" ]; then
+            echo "$image: trial mounts found $found, expected $expected" >&2
+            rc=1
+        fi
+    done <"$dir/corpus/MANIFEST"
+else
+    echo "test_detect: trial mounts need root and losetup, skipped"
+fi
+exit "$rc"
@@ -23,12 +23,14 @@ static ci_bool a = { .def = 0 };
 static ci_bool truc = { .def = 0 };
 static ci_bool machin = { .def = 0 };
 static ci_string_list list;
+static ci_uint number = { .value = 0 };
 
 static cf_spec config[] = {
     { .base = "a", .type = boolean_item, .boolean_item = &a },
     { .base = "truc", .type = boolean_item, .boolean_item = &truc },
     { .base = "machin", .type = boolean_item, .boolean_item = &machin },
     { .base = "list", .type = string_list, .string_list = &list },
+    { .base = "number", .type = uint_item, .uint_item = &number },
     { .base = NULL }
 };
 
@@ -71,6 +73,8 @@ main(int argc, const char *argv[])
         }
 
     fprintf(stderr, "\n");
+
+    fprintf(stderr, "\nnumber value: %u\n", number.value);
     fclose(f);
-    return EXIT_SUCCESS;
+    return number.value == 12 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -2,6 +2,9 @@
    These checks include:
 
    * fstab_has_device, to check mismatches
+   * fstab_has_mntpt, without asking for the device
+   * mount_owner_check, which must not vouch for mounts of someone else or
+     mounts pmount did not record
 
 */
 
@@ -12,10 +15,12 @@
  * GNU General Public License. See file GPL for the full text of the license.
  */
 
+#define _GNU_SOURCE
 #include "policy.h"
 #include "utils.h"
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 static int totalTests = 0;
@@ -34,6 +39,18 @@ check_strings_equal(const char *name, const char *str1, const char *str2)
     return rc;
 }
 
+static bool
+check_ints_equal(const char *name, int i1, int i2)
+{
+    bool rc = i1 == i2;
+    ++totalTests;
+    fprintf(stderr, "%s (%d, %d): %s\n", name, i1, i2,
+            rc ? "success" : "failure");
+    if(!rc)
+        ++testsFailed;
+    return rc;
+}
+
 int
 main(void)
 {
@@ -56,6 +73,56 @@ main(void)
     check_strings_equal(
         "check_fstab, fstab double link", "check_fstab/e",
         fstab_has_device("check_fstab/fstab", "check_fstab/c", NULL, NULL));
+
+    /* fstab_has_mntpt */
+
+    check_ints_equal("check_fstab, mount point", 1,
+                     fstab_has_mntpt("check_fstab/fstab", "/foo", NULL));
+
+    check_ints_equal("check_fstab, unknown mount point", 0,
+                     fstab_has_mntpt("check_fstab/fstab", "/bar", NULL));
+
+    /* mount_owner_record/check: check_fstab stands for the mount point */
+
+    check_ints_equal("mount owner, no record", 0,
+                     mount_owner_check("check_fstab/owners", "check_fstab",
+                                       1000));
+
+    check_ints_equal("mount owner, record", 0,
+                     mount_owner_record("check_fstab/owners", "check_fstab",
+                                        1000));
+
+    check_ints_equal("mount owner, same user", 1,
+                     mount_owner_check("check_fstab/owners", "check_fstab",
+                                       1000));
+
+    check_ints_equal("mount owner, someone else", 0,
+                     mount_owner_check("check_fstab/owners", "check_fstab",
+                                       1001));
+
+    check_ints_equal("mount owner, another mount point", 0,
+                     mount_owner_check("check_fstab/owners", "check_fstab/a",
+                                       1000));
+
+    /* a record left over from an earlier mount on the same directory */
+    char *real = realpath("check_fstab", NULL);
+    char *record = make_lock_path("check_fstab/owners", real);
+    FILE *f = fopen(record, "w");
+    if(f) {
+        fputs("1000 0\n", f);
+        fclose(f);
+    }
+    check_ints_equal("mount owner, other mount since", 0,
+                     mount_owner_check("check_fstab/owners", "check_fstab",
+                                       1000));
+    free(record);
+    free(real);
+
+    mount_owner_forget("check_fstab/owners", "check_fstab");
+    check_ints_equal("mount owner, forgotten", 0,
+                     mount_owner_check("check_fstab/owners", "check_fstab",
+                                       1000));
+
     fprintf(stderr, "\n%d tests, %d failed\n", totalTests, testsFailed);
     return testsFailed != 0;
 }
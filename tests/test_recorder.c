@@ -0,0 +1,86 @@
+/*
+ * This software is distributed under the terms and conditions of the
+ * GNU General Public License. See file GPL for the full text of the license.
+ */
+
+/**
+   This program checks that the events of the flight recorder survive
+   a dump and decode, that the ring keeps the last ones, and that the
+   dump of a forked run, appended to the same file, starts afresh.
+ */
+
+#define _GNU_SOURCE
+#include "recorder.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int
+check_contains(const char *text, const char *expected)
+{
+    if(!strstr(text, expected)) {
+        fprintf(stderr, "Decoded dump lacks '%s':\n%s", expected, text);
+        return 1;
+    }
+    return 0;
+}
+
+int
+main(void)
+{
+    char *text = NULL;
+    size_t size = 0;
+    FILE *dump, *out;
+    int failed = 0;
+
+    for(int i = 0; i < 200; i++)
+        recorder_phase("filler");
+    recorder_event(REC_SPAWN, 42, "/sbin/fsck");
+    recorder_event(REC_CHILD, 8, "/sbin/fsck");
+    errno = ENOENT;
+    recorder_error("open device");
+    recorder_event(REC_DEVICE, 0, "/dev/this/is/a/very/long/path/that/gets/"
+                                  "truncated/from/the/start/sdb1");
+
+    dump = tmpfile();
+    out = open_memstream(&text, &size);
+    if(!dump || !out) {
+        perror("tmpfile");
+        return EXIT_FAILURE;
+    }
+    if(recorder_dump(fileno(dump), 4, 0)) {
+        perror("recorder_dump");
+        return EXIT_FAILURE;
+    }
+    recorder_fork();
+    recorder_event(REC_DEVICE, 0, "/dev/sdc1");
+    if(recorder_dump(fileno(dump), 5, 0)) {
+        perror("recorder_dump");
+        return EXIT_FAILURE;
+    }
+    rewind(dump);
+    if(recorder_decode(dump, out)) {
+        fprintf(stderr, "Could not decode the dump\n");
+        return EXIT_FAILURE;
+    }
+    fclose(out);
+    fclose(dump);
+
+    failed += check_contains(text, "exit status 4");
+    failed += check_contains(text, "(76 older events lost)");
+    failed += check_contains(text, "spawn   /sbin/fsck (pid 42)");
+    failed += check_contains(text, "child   /sbin/fsck: status 8");
+    failed += check_contains(text, "open device: No such file or directory");
+    failed += check_contains(text, "/truncated/from/the/start/sdb1\n");
+    failed += check_contains(text, "exit status 5\n");
+    failed += check_contains(text, "device  /dev/sdc1\n");
+    /* the forked run does not carry the events of its parent */
+    if(strstr(text, "exit status 5\n") &&
+       strstr(strstr(text, "exit status 5\n"), "filler")) {
+        fprintf(stderr, "The forked run kept the events of its parent\n");
+        failed++;
+    }
+    free(text);
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}